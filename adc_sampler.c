@@ -0,0 +1,88 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "adc_sampler.h"
+
+#if ADC_SAMPLER_OVERSAMPLE_BITS > 3
+  #error "ADC_SAMPLER_OVERSAMPLE_BITS must be 3 or less"
+#endif
+#if ADC_SAMPLER_CHANNELS < 1 || ADC_SAMPLER_CHANNELS > 8
+  #error "ADC_SAMPLER_CHANNELS must be between 1 and 8"
+#endif
+
+#define SAMPLES_PER_RESULT (1 << (2 * ADC_SAMPLER_OVERSAMPLE_BITS))
+
+// Two result blocks: readers use results[front] while the ISR fills the
+// other one, then the ISR flips front once every channel has a new value.
+static volatile uint16_t results[2][ADC_SAMPLER_CHANNELS];
+static volatile uint8_t front;
+static volatile uint8_t generation;
+
+// ISR state
+static uint16_t sum;
+static uint8_t samples;
+static uint8_t channel;
+static uint8_t discard;
+
+void adc_sampler_init(void)
+{
+  channel = 0;
+  samples = 0;
+  sum = 0;
+  discard = 1;
+
+  ADMUX  = (1 << REFS0);                  // AVCC reference, right adjusted, ADC0
+  ADCSRB = 0;                             // Free running trigger
+  DIDR0  = (1 << ADC_SAMPLER_CHANNELS) - 1; // Digital inputs off on ADC pins
+
+  // Prescaler 64: 125kHz ADC clock at 8MHz, ~9.6k conversions/s
+  ADCSRA = (1 << ADEN) | (1 << ADATE) | (1 << ADIE)
+         | (1 << ADPS2) | (1 << ADPS1);
+  ADCSRA |= (1 << ADSC);
+}
+
+uint16_t adc_sampler_read(uint8_t ch)
+{
+  // The ISR won't touch the front block until it has filled the other one,
+  // which takes many conversions, so a plain read is consistent
+  return results[front][ch];
+}
+
+uint8_t adc_sampler_generation(void)
+{
+  return generation;
+}
+
+ISR(ADC_vect)
+{
+  uint16_t value = ADC;
+  uint8_t back;
+
+  // In free-running mode the next conversion has already started with the
+  // old mux setting when this runs, so the first result after a channel
+  // switch belongs to the previous input
+  if (discard) {
+    discard--;
+    return;
+  }
+
+  sum += value;
+  if (++samples < SAMPLES_PER_RESULT)
+    return;
+
+  back = front ^ 1;
+  results[back][channel] = sum >> ADC_SAMPLER_OVERSAMPLE_BITS;
+  sum = 0;
+  samples = 0;
+
+  if (++channel == ADC_SAMPLER_CHANNELS) {
+    channel = 0;
+    front = back;
+    generation++;
+  }
+
+#if ADC_SAMPLER_CHANNELS > 1
+  ADMUX = (ADMUX & 0xf0) | channel;
+  discard = 1;
+#endif
+}
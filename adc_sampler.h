@@ -0,0 +1,37 @@
+/*
+  Free-running ADC sampler --
+  Converts continuously in the background from ADC_vect, oversamples and
+  decimates each input, and publishes a complete block of results at a
+  time, so readers get the latest values in O(1) without waiting on the ADC.
+*/
+
+#ifndef ADC_SAMPLER_H
+#define ADC_SAMPLER_H
+
+#include <stdint.h>
+
+// Number of inputs sampled, starting at ADC0
+#if !defined(ADC_SAMPLER_CHANNELS)
+  #define ADC_SAMPLER_CHANNELS 2
+#endif
+
+// Extra bits of resolution gained by oversampling: 4^n conversions are
+// summed and shifted right by n, giving (10 + n) bit results. The sum is
+// kept in 16 bits, so n can be at most 3.
+#if !defined(ADC_SAMPLER_OVERSAMPLE_BITS)
+  #define ADC_SAMPLER_OVERSAMPLE_BITS 2
+#endif
+
+#define ADC_SAMPLER_RESULT_BITS (10 + ADC_SAMPLER_OVERSAMPLE_BITS)
+
+// Starts free-running conversions. Interrupts must be enabled for results
+// to arrive.
+void adc_sampler_init(void);
+
+// Latest decimated result for a channel, ADC_SAMPLER_RESULT_BITS wide
+uint16_t adc_sampler_read(uint8_t ch);
+
+// Increments each time a new block of results is published
+uint8_t adc_sampler_generation(void);
+
+#endif
@@ -28,97 +28,332 @@
   ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
   POSSIBILITY OF SUCH DAMAGE. */
 
-#include <avr/io.h>
-#include <avr/interrupt.h>
+#include <string.h>
 
 #include "ant.h"
+#include "ant_port.h"
 #include "ring_buffer.h"
 
-// Globals
-uint8_t rx_buf[MAXMSG];
-
-// Ring buffer
-uint8_t buffer[255];
-volatile ring_buffer rx_ring;
-
-// Config
-static ant_configuration _config;
+// Longest data field the parser accepts
+#if ANT_RX_META
+  #define RX_MAX_DATA_SIZE MESG_EXT_MAX_DATA_SIZE
+#else
+  #define RX_MAX_DATA_SIZE MESG_MAX_DATA_SIZE
+#endif
+
+// Configuration checks (see ant_config.h)
+ANT_STATIC_ASSERT(ANT_RX_RING_SIZE <= 255, rx_ring_fits_index);
+ANT_STATIC_ASSERT(ANT_RX_RING_SIZE > RX_MAX_DATA_SIZE + MESG_FRAME_SIZE,
+                  rx_ring_holds_frame);
+ANT_STATIC_ASSERT(ANT_RX_MSG_SIZE >= MAXMSG, rx_msg_holds_data_message);
+ANT_STATIC_ASSERT(ANT_RX_MSG_SIZE <= 255, rx_msg_fits_index);
+ANT_STATIC_ASSERT(ANT_RELIABLE_QUEUE_SIZE < 255, reliable_fits_count);
+ANT_STATIC_ASSERT(ANT_POLL_SLAVES < 255, poll_slaves_fit_count);
+ANT_STATIC_ASSERT(ANT_DEFERRED_QUEUE_SIZE < 255, deferred_fits_count);
+ANT_STATIC_ASSERT(ANT_RX_BUFFERS >= 1 && ANT_RX_BUFFERS < 255,
+                  rx_buffers_fit_index);
+ANT_STATIC_ASSERT(ANT_PERIOD_WINDOW >= 1 && ANT_PERIOD_WINDOW <= 255,
+                  period_window_fits_count);
+ANT_STATIC_ASSERT(ANT_PERIOD_MAX_HOLD >= 1 && ANT_PERIOD_MAX_HOLD <= 128 &&
+                  !(ANT_PERIOD_MAX_HOLD & (ANT_PERIOD_MAX_HOLD - 1)),
+                  period_hold_power_of_two);
+#if ANT_SCAN
+ANT_STATIC_ASSERT(ANT_RX_MSG_SIZE >= 18, rx_msg_holds_extended_message);
+ANT_STATIC_ASSERT(ANT_SCAN_DEVICES >= 1 && ANT_SCAN_DEVICES < 255,
+                  scan_devices_fit_count);
+#endif
+#if ANT_RX_META
+ANT_STATIC_ASSERT(ANT_RX_MSG_SIZE >= (ANT_SCAN ? 23 : 19),
+                  rx_msg_holds_metadata);
+#endif
+#if ANT_TRACE
+ANT_STATIC_ASSERT((ANT_TRACE_STAMPS & (ANT_TRACE_STAMPS - 1)) == 0,
+                  trace_stamps_power_of_two);
+ANT_STATIC_ASSERT(ANT_TRACE_STAMPS <= 128, trace_stamps_fit_counter);
+ANT_STATIC_ASSERT(ANT_TRACE_BUCKETS >= 1 && ANT_TRACE_BUCKETS <= 16,
+                  trace_buckets_fit_ticks);
+#endif
+
+// Debug output
+#if ANT_DEBUG
+  #define ANT_LOG(fmt, ...) ANT_PORT_LOG(fmt, ##__VA_ARGS__)
+#else
+  #define ANT_LOG(fmt, ...)
+#endif
+
+// ant_deferred.kind, in order of priority
+#define DEFERRED_EVENT_TX    0  // Late means missing the TX slot
+#define DEFERRED_DELIVERY    1
+#define DEFERRED_BROADCAST   2
+
+// ant_ctx.deferred_slots and ant_deferred.slots, the driver's share of a
+// TX slot still to come
+#define DEFERRED_SLOT_TX     0x01  // EVENT_TX
+#define DEFERRED_SLOT_RX     0x02  // A slave received from the master
+
+// The callback is only timed when dispatch makes the call
+#define TRACE_CALLBACK (ANT_TRACE && ANT_DEFERRED_QUEUE_SIZE == 0)
+
+// ctx->paired_state
+#define PAIRED_NONE       0
+#define PAIRED_REQUESTED  1
+#define PAIRED_VALID      2
 
 // Internal prototypes
 //=======================
-static void ant_config(void);
-static void dispatch_msg(uint8_t len);
-static void reset (void);
-static void get_capabilities(void);
-static void assign_channel_id(uint8_t type);
-static void set_channel_id(void);
-static void timeout(uint8_t timeout);
-static void set_frequency(uint8_t frequency);
-static void set_channel_period(uint16_t period);
-static void open_channel(void);
+static void ant_config(ant_ctx *ctx);
+static void dispatch_msg(ant_ctx *ctx, uint8_t len);
+static void reset(ant_ctx *ctx);
+static void assign_channel_id(ant_ctx *ctx, uint8_t type);
+static void set_channel_id(ant_ctx *ctx);
+static void id_list_add(ant_ctx *ctx, ant_channel_id *id, uint8_t index);
+static void id_list_config(ant_ctx *ctx, uint8_t size, uint8_t exclude);
+static void request_channel_id(ant_ctx *ctx);
+static void set_search_timeout(ant_ctx *ctx, uint8_t timeout);
+static void set_lp_search_timeout(ant_ctx *ctx, uint8_t timeout);
+static void set_frequency(ant_ctx *ctx, uint8_t frequency);
+static void set_channel_period(ant_ctx *ctx, uint16_t period);
+static void open_channel(ant_ctx *ctx);
+#if ANT_SCAN
+#if !ANT_RX_META
+static void enable_ext_messages(ant_ctx *ctx);
+#endif
+static void open_rx_scan(ant_ctx *ctx);
+static void scan_record(ant_ctx *ctx, uint8_t *id, uint8_t *data);
+#endif
+#if ANT_RX_META
+static void set_lib_config(ant_ctx *ctx, uint8_t flags);
+static void rx_meta_parse(ant_ctx *ctx, uint8_t len);
+#endif
 static uint8_t checksum(uint8_t *data, uint8_t length);
-static void uart_putchar(char c);
-static void send_to_ant(uint8_t* buffer, uint8_t len);
-static void delay_ms(uint16_t x);
-static void print_msg(uint8_t len);
+#if ANT_RX_BUFFERS > 1
+static uint8_t rx_buffer_ready(ant_ctx *ctx);
+static int8_t rx_buffer_index(ant_ctx *ctx, const uint8_t *buf);
+#endif
+static inline void frame_hook(ant_ctx *ctx, uint8_t dir, const uint8_t *buf,
+                              uint8_t len);
+static void send_to_ant(ant_ctx *ctx, uint8_t* buffer, uint8_t len);
+static inline void call_event_tx(ant_ctx *ctx);
+static inline void call_broadcast_recv(ant_ctx *ctx, uint8_t *buf,
+                                       uint8_t len);
+#if ANT_RELIABLE_QUEUE_SIZE > 0
+static inline void call_delivery(ant_ctx *ctx, uint8_t id, uint8_t status);
+#endif
+static void tx_slot(ant_ctx *ctx);
+static void rx_slot(ant_ctx *ctx);
+#if ANT_DEFERRED_QUEUE_SIZE > 0
+static void deferred_add(ant_ctx *ctx, uint8_t kind, const uint8_t *buf,
+                         uint8_t len);
+static void deferred_slot(ant_ctx *ctx, uint8_t slot);
+static void deferred_slots_run(ant_ctx *ctx);
+#endif
+#if ANT_DEBUG
+static void print_msg(ant_ctx *ctx, uint8_t len);
+#else
+  #define print_msg(ctx, len)
+#endif
+#if ANT_PUBLISH
+static void publish_slot(ant_ctx *ctx);
+#endif
+#if ANT_RELIABLE_QUEUE_SIZE > 0
+static uint8_t reliable_slot(ant_ctx *ctx);
+static void reliable_result(ant_ctx *ctx, uint8_t code);
+#endif
+#if ANT_ADAPTIVE_PERIOD
+static void period_note(ant_ctx *ctx, uint8_t *data);
+static void period_adapt(ant_ctx *ctx);
+static void period_follow(ant_ctx *ctx, uint8_t received);
+#endif
+#if ANT_POLL_SLAVES > 0
+static void poll_settle(ant_ctx *ctx);
+static uint8_t poll_slot(ant_ctx *ctx);
+static void poll_response(ant_ctx *ctx, uint16_t addr);
+#endif
+
+#if defined(ANT_CALLBACK_EVENT_TX)
+void ANT_CALLBACK_EVENT_TX(ant_ctx *ctx);
+#endif
+#if defined(ANT_CALLBACK_BROADCAST_RECV)
+void ANT_CALLBACK_BROADCAST_RECV(ant_ctx *ctx, uint8_t *buf, uint8_t len);
+#endif
+#if defined(ANT_CALLBACK_DELIVERY)
+void ANT_CALLBACK_DELIVERY(ant_ctx *ctx, uint8_t id, uint8_t status);
+#endif
+#if defined(ANT_CALLBACK_SCAN_RECV)
+void ANT_CALLBACK_SCAN_RECV(ant_ctx *ctx, ant_scan_device *dev);
+#endif
+#if defined(ANT_CALLBACK_FRAME)
+void ANT_CALLBACK_FRAME(ant_ctx *ctx, uint8_t dir, const uint8_t *buf,
+                        uint8_t len);
+#endif
 //=======================
 
-// USART RX interrupt handler
-ISR(USART_RX_vect) {
-  rb_push(&rx_ring, UDR0);
+// Called when the message in rx_buf turns out to be bogus (bad length or
+// checksum). Instead of dropping all n bytes, only the false sync at
+// rx_buf[0] is discarded: the rest is fed through the parser again ahead
+// of the ring, so a real sync hidden in there is found straight away.
+// Bytes still waiting from an earlier replay are kept behind them.
+// Returns the new message length.
+static uint8_t resync(ant_ctx *ctx, uint8_t n)
+{
+  uint8_t rest = ctx->replay_end - ctx->replay_pos;
+
+  // n never exceeds replay_pos, the parser writes behind where it reads
+  memmove(ctx->rx_buf + n, ctx->rx_buf + ctx->replay_pos, rest);
+  ctx->replay_pos = 1;
+  ctx->replay_end = n + rest;
+  ctx->in_msg = FALSE;
+
+  return 0;
 }
 
-void ant_handle_msg(void)
+// Hands bytes read from the module to the parser, for ports that receive
+// in blocks rather than from an RX interrupt. The ring is topped up and
+// drained in turn, so len may be any size; messages are dispatched as they
+// complete.
+void ant_feed(ant_ctx *ctx, const uint8_t *buf, uint16_t len)
 {
-  uint8_t msg_n = 0;;
-  uint8_t in_msg = FALSE;
-  
+  while (len > 0)
+  {
+    while (len > 0 && rb_count(&ctx->rx_ring) < ANT_RX_RING_SIZE - 1)
+    {
+      ant_rx_byte(ctx, *buf++);
+      len--;
+    }
+
+    while (rb_count(&ctx->rx_ring) > 0 || ctx->replay_pos < ctx->replay_end)
+    {
+#if ANT_RX_BUFFERS > 1
+      // The parser is stalled until the application releases a buffer,
+      // what doesn't fit in the ring is lost
+      if (rx_buffer_ready(ctx) == FALSE)
+      {
+        ctx->stats.ring_overflows += len;
+        return;
+      }
+#endif
+      ant_handle_msg(ctx);
+    }
+  }
+}
+
+// Parses whatever is waiting in the RX ring and dispatches at most one
+// complete message. Parser state lives in the context, so a partially
+// received message is resumed on the next call instead of busy-waiting on
+// the UART (which would stall every other radio on the MCU).
+void ant_handle_msg(ant_ctx *ctx)
+{
+  uint8_t *rx_buf;
+  uint8_t msg_n = ctx->msg_n;
+  uint8_t waiting;
+  uint8_t from_ring;
+  uint8_t byte;
   pop_value value;
+
+#if ANT_RX_BUFFERS > 1
+  // Every buffer is held by the application: leave the bytes in the ring
+  if (rx_buffer_ready(ctx) == FALSE)
+    return;
+#endif
+  rx_buf = ctx->rx_buf;
+
+  // Sampled once per call rather than in the ISR to keep the ISR short
+  waiting = rb_count(&ctx->rx_ring);
+  if (waiting > ctx->stats.ring_high_water)
+    ctx->stats.ring_high_water = waiting;
   
   while(1) {
-    value = rb_pop(&rx_ring);
+    if (ctx->replay_pos < ctx->replay_end) {
+      // Left over from a message that turned out to be bogus
+      byte = rx_buf[ctx->replay_pos++];
+      from_ring = FALSE;
+    } else {
+      value = rb_pop(&ctx->rx_ring);
 
-    // Nothing to read and we're not waiting on a message
-    if (value.success == 0 && in_msg == FALSE)
-    return;
+      // Nothing left to read, keep any partial message for the next call
+      if (value.success == 0) {
+        ctx->msg_n = msg_n;
+        return;
+      }
 
-    // We must be waiting for a byte
-    if (value.success == 0 && in_msg == TRUE)
-    continue;
+      byte = value.byte;
+      from_ring = TRUE;
+      if (byte == MESG_TX_SYNC)
+        ctx->parsed_syncs++;
+    }
 
-    if ((value.byte == MESG_TX_SYNC) && (in_msg == FALSE)) {
+    if ((byte == MESG_TX_SYNC) && (ctx->in_msg == FALSE)) {
+#if ANT_TRACE
+      // The stamp slot is reused once ANT_TRACE_STAMPS newer syncs arrive
+      ctx->frame_stamp_valid = from_ring &&
+        (uint8_t)(ctx->rx_syncs - ctx->parsed_syncs) < ANT_TRACE_STAMPS;
+      ctx->frame_stamp =
+        ctx->sync_stamps[(uint8_t)(ctx->parsed_syncs - 1) & (ANT_TRACE_STAMPS - 1)];
+#else
+      (void)from_ring;
+#endif
       msg_n = 0;  // Always reset when we receive a sync header
-      in_msg = TRUE;
-      rx_buf[msg_n] = value.byte;
+      ctx->in_msg = TRUE;
+      rx_buf[msg_n] = byte;
       msg_n++;
+    } else if (ctx->in_msg == FALSE) {
+      // Noise between messages
+      continue;
     } else if (msg_n == 1) {
-      // Size
-      rx_buf[msg_n] = value.byte;
+      // Size, anything longer than a message or rx_buf is a false sync
+      rx_buf[msg_n] = byte;
       msg_n++;
+      if (byte > RX_MAX_DATA_SIZE || byte + MESG_FRAME_SIZE > ANT_RX_MSG_SIZE) {
+        ctx->stats.length_errors++;
+        msg_n = resync(ctx, msg_n);
+      }
     } else if (msg_n == 2) {
       // Type
-      rx_buf[msg_n] = value.byte;
+      rx_buf[msg_n] = byte;
       msg_n++;
     } else if (msg_n < rx_buf[1] + 3) {
-      rx_buf[msg_n] = value.byte;
+      rx_buf[msg_n] = byte;
       msg_n++;
     } else {
-      in_msg = FALSE;
-      rx_buf[msg_n] = value.byte;
+      ctx->in_msg = FALSE;
+      rx_buf[msg_n] = byte;
 
       if (checksum(rx_buf, msg_n) == rx_buf[msg_n])
       {
-        dispatch_msg(msg_n);
-      } else {
-        printf("checksum failed\n");
+        ctx->msg_n = 0;
+        ctx->stats.rx_frames++;
+#if ANT_TRACE
+        ctx->parsed_stamp = ant_trace_now();
+        if (ctx->frame_stamp_valid == TRUE)
+          ant_trace_record(ANT_TRACE_RX_TO_PARSED,
+                           ctx->parsed_stamp - ctx->frame_stamp);
+#endif
+
+        // Every sync byte still in the ring is (almost always) the start of
+        // another frame queued up behind this one
+        waiting = ctx->rx_syncs - ctx->parsed_syncs;
+        if (waiting > ctx->stats.max_frames_pending)
+          ctx->stats.max_frames_pending = waiting;
+
+        frame_hook(ctx, ANT_FRAME_RX, rx_buf, msg_n + 1);
+        dispatch_msg(ctx, msg_n);
+        return;
       }
-      break;
+
+      ctx->stats.checksum_errors++;
+      ANT_LOG("checksum failed\n");
+      msg_n = resync(ctx, msg_n + 1);
     }
   }
 }
 
-void dispatch_msg(uint8_t len)
+void dispatch_msg(ant_ctx *ctx, uint8_t len)
 {
+  uint8_t *rx_buf = ctx->rx_buf;
+#if TRACE_CALLBACK
+  uint16_t t0;
+#endif
+
   switch(rx_buf[2])
   {
     case MESG_RESPONSE_EVENT_ID:
@@ -129,51 +364,490 @@ void dispatch_msg(uint8_t len)
           case RESPONSE_NO_ERROR:
             return;
           case EVENT_RX_SEARCH_TIMEOUT:
-            printf("EVENT_RX_SEARCH_TIMEOUT, re-opening channel...\n");
-            ant_config();
+            // The module closes the channel on its own right after this
+            ctx->stats.search_timeouts++;
+            ANT_LOG("EVENT_RX_SEARCH_TIMEOUT\n");
+            return;
+          case EVENT_CHANNEL_CLOSED:
+            // Everything else is still configured, opening it again is
+            // enough to start a new search
+            ANT_LOG("EVENT_CHANNEL_CLOSED, re-opening channel...\n");
+            ctx->stats.reopens++;
+            ctx->paired_state = PAIRED_NONE;  // May find someone else
+#if ANT_RELIABLE_QUEUE_SIZE > 0
+            // No result comes for a message in flight, count it as failed
+            reliable_result(ctx, EVENT_TRANSFER_TX_FAILED);
+#endif
+#if ANT_ADAPTIVE_PERIOD
+            // Whoever we find next runs at least at the configured rate
+            if (ctx->config.master == FALSE &&
+                ctx->period != ctx->config.period)
+            {
+              ctx->period = ctx->config.period;
+              ctx->period_slots = 0;
+              ctx->period_fails = 0;
+              ctx->period_clean = 0;
+              ctx->period_trying = FALSE;
+              set_channel_period(ctx, ctx->period);
+            }
+#endif
+#if ANT_SCAN
+            if (ctx->config.scan == TRUE)
+            {
+              open_rx_scan(ctx);
+              return;
+            }
+#endif
+            open_channel(ctx);
             return;
           case EVENT_RX_FAIL:
             // Not great, but not the end of the world
+            ctx->stats.rx_fails++;
+#if ANT_ADAPTIVE_PERIOD
+            if (ctx->config.master == FALSE)
+              period_follow(ctx, FALSE);
+#endif
             return;
           case EVENT_TX:
-            if (_config.callback_event_tx > 0)
-            {
-              _config.callback_event_tx();
-            }
+#if ANT_DEFERRED_QUEUE_SIZE > 0
+            deferred_add(ctx, DEFERRED_EVENT_TX, NULL, 0);
+#else
+            call_event_tx(ctx);
+#endif
+#if ANT_ADAPTIVE_PERIOD
+            period_adapt(ctx);
+#endif
+#if ANT_POLL_SLAVES > 0
+            poll_settle(ctx);
+#endif
+#if ANT_DEFERRED_QUEUE_SIZE > 0
+            // Used once ant_run_deferred() has run the callback
+            deferred_slot(ctx, DEFERRED_SLOT_TX);
+#else
+            tx_slot(ctx);
+#endif
+            return;
+#if ANT_RELIABLE_QUEUE_SIZE > 0
+          case EVENT_TRANSFER_TX_COMPLETED:
+          case EVENT_TRANSFER_TX_FAILED:
+            reliable_result(ctx, rx_buf[5]);
             return;
+#endif
           default:
-            print_msg(len);
+            print_msg(ctx, len);
             return;
         }
       } else {  // Function Responses
-        print_msg(len);
+        print_msg(ctx, len);
         return;
       }
       return;
+#if ANT_SCAN
+    case MESG_EXT_BROADCAST_DATA_ID:
+      // Legacy extended format: channel, channel ID, 8 data bytes
+#if ANT_RX_META
+      ctx->rx_meta.flags = 0;
+#endif
+      if (len == 3 + 13)
+        scan_record(ctx, &rx_buf[4], &rx_buf[8]);
+      return;
+#endif
     case MESG_BROADCAST_DATA_ID:
-      if (_config.callback_broadcast_recv > 0)
+#if ANT_RX_META
+      rx_meta_parse(ctx, len);
+#endif
+#if ANT_SCAN
+      // Flagged extended format: channel, 8 data bytes, flag byte, then
+      // the channel ID when bit 7 of the flag is set
+      if (len >= 3 + 14 && (rx_buf[12] & 0x80))
       {
-        _config.callback_broadcast_recv(rx_buf, len);
+        scan_record(ctx, &rx_buf[13], &rx_buf[4]);
+        return;
       }
+#endif
+#if ANT_RX_META
+      // The callback sees a plain broadcast, the rest is in rx_meta
+      if (len > 3 + 9)
+        len = 3 + 9;
+#endif
+#if TRACE_CALLBACK
+      t0 = ant_trace_now();
+      ant_trace_record(ANT_TRACE_PARSED_TO_CALLBACK, t0 - ctx->parsed_stamp);
+#endif
+#if ANT_DEFERRED_QUEUE_SIZE > 0
+      deferred_add(ctx, DEFERRED_BROADCAST, rx_buf, len);
+      if (ctx->config.master == FALSE)
+        deferred_slot(ctx, DEFERRED_SLOT_RX);
+#else
+      call_broadcast_recv(ctx, rx_buf, len);
+#endif
+#if TRACE_CALLBACK
+      ant_trace_record(ANT_TRACE_CALLBACK, ant_trace_now() - t0);
+#endif
+#if ANT_POLL_SLAVES > 0
+      if (ctx->config.master == TRUE)
+        poll_response(ctx, rx_buf[4] | (rx_buf[5] << 8));
+#endif
+#if ANT_ADAPTIVE_PERIOD
+      // Only the master picks the period, a slave follows it
+      if (ctx->config.master == FALSE)
+        period_follow(ctx, TRUE);
+#endif
+#if ANT_DEFERRED_QUEUE_SIZE == 0
+      if (ctx->config.master == FALSE)
+        rx_slot(ctx);
+#endif
+      // Receiving means the slave has paired, find out with whom
+      if (ctx->config.master == FALSE && ctx->paired_state == PAIRED_NONE)
+      {
+        request_channel_id(ctx);
+        ctx->paired_state = PAIRED_REQUESTED;
+      }
+      return;
+    case MESG_CHANNEL_ID_ID:
+      ctx->paired_id.device_number = rx_buf[4] | (rx_buf[5] << 8);
+      ctx->paired_id.device_type = rx_buf[6];
+      ctx->paired_id.transmission_type = rx_buf[7];
+      ctx->paired_state = PAIRED_VALID;
+      ANT_LOG("paired with %u/%u/%u\n", ctx->paired_id.device_number,
+              ctx->paired_id.device_type, ctx->paired_id.transmission_type);
       return;
+#if ANT_RELIABLE_QUEUE_SIZE > 0
+    case MESG_STARTUP_MESG_ID:
+      // The module was reset and dropped the message in flight
+      reliable_result(ctx, EVENT_TRANSFER_TX_FAILED);
+      print_msg(ctx, len);
+      return;
+#endif
     default:    // No idea what this is...
-      print_msg(len);
+      print_msg(ctx, len);
       return;
   }
 }
 
-void print_msg(uint8_t len)
+// Copies the counters out. The ISR updates some of them, so the copy is
+// taken with interrupts off to get consistent multi-byte values.
+void ant_get_stats(ant_ctx *ctx, ant_stats *stats)
+{
+  ANT_ATOMIC
+  {
+    *stats = ctx->stats;
+  }
+}
+
+// Channel ID of the device a slave is receiving from. With wildcards in
+// the configured channel ID this is how the application learns which
+// device it paired with. Returns FALSE until it is known.
+uint8_t ant_get_paired_id(ant_ctx *ctx, ant_channel_id *id)
+{
+  if (ctx->paired_state != PAIRED_VALID)
+    return FALSE;
+
+  *id = ctx->paired_id;
+  return TRUE;
+}
+
+#if ANT_SCAN
+// Files a message heard in scan mode under the device that sent it. When
+// the table is full the device heard from least recently makes room.
+void scan_record(ant_ctx *ctx, uint8_t *id, uint8_t *data)
+{
+  ant_scan_device *dev;
+  uint16_t number = id[0] | (id[1] << 8);
+  uint16_t age, oldest_age = 0;
+  uint8_t i, oldest = 0;
+
+  ctx->scan_clock++;
+
+  for (i = 0; i < ctx->scan_count; i++)
+  {
+    dev = &ctx->scan_devices[i];
+    if (dev->id.device_number == number &&
+        dev->id.device_type == id[2] &&
+        dev->id.transmission_type == id[3])
+      break;
+
+    age = ctx->scan_clock - dev->last_seen;
+    if (age > oldest_age)
+    {
+      oldest_age = age;
+      oldest = i;
+    }
+  }
+
+  if (i == ctx->scan_count)  // Someone new
+  {
+    if (ctx->scan_count < ANT_SCAN_DEVICES)
+      ctx->scan_count++;
+    else
+      i = oldest;
+
+    dev = &ctx->scan_devices[i];
+    dev->id.device_number = number;
+    dev->id.device_type = id[2];
+    dev->id.transmission_type = id[3];
+    dev->messages = 0;
+  }
+
+  memcpy(dev->data, data, 8);
+  dev->messages++;
+  dev->last_seen = ctx->scan_clock;
+#if ANT_RX_META
+  if (ctx->rx_meta.flags & ANT_EXT_RSSI)
+    dev->rssi = ctx->rx_meta.rssi;
+  if (ctx->rx_meta.flags & ANT_EXT_TIMESTAMP)
+    dev->timestamp = ctx->rx_meta.timestamp;
+#endif
+
+#if defined(ANT_CALLBACK_SCAN_RECV)
+  ANT_CALLBACK_SCAN_RECV(ctx, dev);
+#else
+  if (ctx->config.callback_scan_recv > 0)
+  {
+    ctx->config.callback_scan_recv(ctx, dev);
+  }
+#endif
+}
+
+// Devices heard in scan mode so far, in no particular order. The table is
+// only written from ant_handle_msg(), so it can be read between calls.
+const ant_scan_device *ant_scan_table(ant_ctx *ctx, uint8_t *count)
+{
+  *count = ctx->scan_count;
+  return ctx->scan_devices;
+}
+#endif
+
+#if ANT_RX_META
+// Extended fields the module sent with the broadcast being delivered to
+// callback_broadcast_recv. Only valid inside the callback; flags is 0 if
+// the module sent none.
+const ant_rx_meta *ant_get_rx_meta(ant_ctx *ctx)
+{
+  return &ctx->rx_meta;
+}
+
+// Flagged extended format: channel, 8 data bytes, flag byte, then the
+// fields the flag announces. Fields cut short by len are left out.
+void rx_meta_parse(ant_ctx *ctx, uint8_t len)
+{
+  uint8_t *rx_buf = ctx->rx_buf;
+  ant_rx_meta *meta = &ctx->rx_meta;
+  uint8_t flags, n = 13;
+
+  meta->flags = 0;
+  if (len < 3 + 10)
+    return;
+  flags = rx_buf[12];
+
+  if (flags & ANT_EXT_CHANNEL_ID)
+  {
+    if (n + 4 > len)
+      return;
+    meta->id.device_number = rx_buf[n] | (rx_buf[n + 1] << 8);
+    meta->id.device_type = rx_buf[n + 2];
+    meta->id.transmission_type = rx_buf[n + 3];
+    meta->flags |= ANT_EXT_CHANNEL_ID;
+    n += 4;
+  }
+
+  if (flags & ANT_EXT_RSSI)
+  {
+    if (n + 3 > len)
+      return;
+    meta->rssi = (int8_t)rx_buf[n + 1];       // rx_buf[n] is the type
+    meta->threshold = (int8_t)rx_buf[n + 2];
+    meta->flags |= ANT_EXT_RSSI;
+    n += 3;
+  }
+
+  if (flags & ANT_EXT_TIMESTAMP)
+  {
+    if (n + 2 > len)
+      return;
+    meta->timestamp = rx_buf[n] | (rx_buf[n + 1] << 8);
+    meta->flags |= ANT_EXT_TIMESTAMP;
+  }
+}
+#endif
+
+// Channel period currently in use, in 1/32768s
+uint16_t ant_get_period(ant_ctx *ctx)
+{
+  return ctx->period;
+}
+
+#if ANT_ADAPTIVE_PERIOD
+// Remembers whether a data payload differs from the previous one
+void period_note(ant_ctx *ctx, uint8_t *data)
+{
+  if (memcmp(ctx->period_last, data, 6) != 0)
+  {
+    memcpy(ctx->period_last, data, 6);
+    ctx->period_changed = TRUE;
+  }
+}
+
+// Master, once per channel period (EVENT_TX). At the end of each window
+// the period is halved if the data changed on at least 3/4 of the
+// messages or acknowledged messages were queuing up, doubled if it never
+// changed, and sent to the module if that moved it. Steps that would leave
+// the bounds aren't taken, so the period stays a power of two times the
+// configured one.
+void period_adapt(ant_ctx *ctx)
+{
+  uint32_t period = ctx->period;
+
+  if (ctx->period_changed == TRUE)
+    ctx->period_changes++;
+  ctx->period_changed = FALSE;
+#if ANT_RELIABLE_QUEUE_SIZE > 0
+  if (ctx->reliable_count > 1)
+    ctx->period_backlog = TRUE;
+#endif
+
+  if (++ctx->period_slots < ANT_PERIOD_WINDOW)
+    return;
+
+  if (ctx->period_backlog == TRUE ||
+      ctx->period_changes >= (ANT_PERIOD_WINDOW * 3 + 3) / 4)
+  {
+    if (!(period & 1) && (period >> 1) >= ctx->config.period_min)
+      period >>= 1;
+  }
+  else if (ctx->period_changes == 0)
+  {
+    if ((period << 1) <= ctx->config.period_max)
+      period <<= 1;
+  }
+
+  ctx->period_slots = 0;
+  ctx->period_changes = 0;
+  ctx->period_backlog = FALSE;
+
+  if (period != ctx->period)
+  {
+    ctx->period = period;
+    ANT_LOG("channel period %u\n", ctx->period);
+    set_channel_period(ctx, ctx->period);
+  }
+}
+
+// Slave, once per channel period: a received message or EVENT_RX_FAIL. A
+// master that doubled its period leaves every other slot of ours empty,
+// so when at least 3/8 of a window's slots fail the period is doubled too,
+// up to period_max. A slave slower than its master still receives in every
+// slot, so after period_hold clean windows it tries half the period, back
+// down to the configured one. A try that fails at once was wrong: the
+// period goes back up and the next try waits twice as long, up to
+// ANT_PERIOD_MAX_HOLD windows.
+void period_follow(ant_ctx *ctx, uint8_t received)
+{
+  uint16_t period = ctx->period;
+  uint8_t trying = ctx->period_trying;
+
+  if (received == FALSE)
+    ctx->period_fails++;
+
+  if (++ctx->period_slots < ANT_PERIOD_WINDOW)
+    return;
+
+  ctx->period_trying = FALSE;
+  if (ctx->period_fails >= (ANT_PERIOD_WINDOW * 3 + 7) / 8)
+  {
+    ctx->period_clean = 0;
+    if (((uint32_t)period << 1) <= ctx->config.period_max)
+      period <<= 1;
+    if (trying == TRUE && ctx->period_hold < ANT_PERIOD_MAX_HOLD)
+      ctx->period_hold <<= 1;
+  }
+  else if (ctx->period_fails > 0)
+  {
+    ctx->period_clean = 0;
+  }
+  else
+  {
+    if (trying == TRUE)
+      ctx->period_hold = 1;
+    if (period > ctx->config.period &&
+        ++ctx->period_clean >= ctx->period_hold)
+    {
+      ctx->period_clean = 0;
+      ctx->period_trying = TRUE;
+      period >>= 1;
+    }
+  }
+
+  ctx->period_slots = 0;
+  ctx->period_fails = 0;
+
+  if (period != ctx->period)
+  {
+    ctx->period = period;
+    ANT_LOG("channel period %u\n", ctx->period);
+    set_channel_period(ctx, ctx->period);
+  }
+}
+#endif
+
+// Serialises the counters into a compact frame laid out like an ANT
+// message (sync, length, ANT_STATS_MESG_ID, data, checksum) with
+// little-endian fields, ready to be written to a debug port. buf must hold
+// ANT_STATS_FRAME_SIZE bytes. Returns the number of bytes written.
+uint8_t ant_stats_frame(ant_ctx *ctx, uint8_t *buf)
+{
+  ant_stats stats;
+  uint8_t n = 3;
+
+  ant_get_stats(ctx, &stats);
+
+  buf[0] = MESG_TX_SYNC;
+  buf[1] = ANT_STATS_DATA_SIZE;
+  buf[2] = ANT_STATS_MESG_ID;
+
+  buf[n++] = stats.rx_bytes;
+  buf[n++] = stats.rx_bytes >> 8;
+  buf[n++] = stats.rx_bytes >> 16;
+  buf[n++] = stats.rx_bytes >> 24;
+  buf[n++] = stats.rx_frames;
+  buf[n++] = stats.rx_frames >> 8;
+  buf[n++] = stats.rx_frames >> 16;
+  buf[n++] = stats.rx_frames >> 24;
+  buf[n++] = stats.checksum_errors;
+  buf[n++] = stats.checksum_errors >> 8;
+  buf[n++] = stats.length_errors;
+  buf[n++] = stats.length_errors >> 8;
+  buf[n++] = stats.ring_overflows;
+  buf[n++] = stats.ring_overflows >> 8;
+  buf[n++] = stats.rx_fails;
+  buf[n++] = stats.rx_fails >> 8;
+  buf[n++] = stats.search_timeouts;
+  buf[n++] = stats.search_timeouts >> 8;
+  buf[n++] = stats.reopens;
+  buf[n++] = stats.reopens >> 8;
+  buf[n++] = stats.ring_high_water;
+  buf[n++] = stats.max_frames_pending;
+
+  buf[n] = checksum(buf, n);
+
+  return n + 1;
+}
+
+#if ANT_DEBUG
+void print_msg(ant_ctx *ctx, uint8_t len)
 {
+  uint8_t *rx_buf = ctx->rx_buf;
   uint8_t i;
 
-  printf("m: %x - ", rx_buf[2]);
+  ANT_LOG("m: %x - ", rx_buf[2]);
   for (i = 3; i < len; i++) {
-    printf("%x ", rx_buf[i]);
+    ANT_LOG("%x ", rx_buf[i]);
   }
-  printf("\n");
+  ANT_LOG("\n");
 }
+#endif
 
-void ant_send_broadcast_data(uint16_t addr, uint8_t *data)
+void ant_send_broadcast_data(ant_ctx *ctx, uint16_t addr, uint8_t *data)
 {
   uint8_t buf[13];
   
@@ -192,12 +866,315 @@ void ant_send_broadcast_data(uint16_t addr, uint8_t *data)
   buf[11] = data[5];
   buf[12] = checksum(buf, 12);
   
-  send_to_ant(buf, 13);
+  send_to_ant(ctx, buf, 13);
+
+  ANT_LOG("MESG_BROADCAST_DATA_ID sent\n");
+
+#if ANT_ADAPTIVE_PERIOD
+  // A master judges the rate by what it sends
+  if (ctx->config.master == TRUE)
+    period_note(ctx, data);
+#endif
+}
+
+#if ANT_RELIABLE_QUEUE_SIZE > 0
+// Queues an acknowledged message for delivery. It goes out at once if
+// nothing else is in flight, otherwise after the messages queued before it.
+// Returns the id its delivery status will be reported under, or 0 if the
+// queue is full.
+uint8_t ant_send_reliable(ant_ctx *ctx, uint16_t addr, uint8_t *data)
+{
+  ant_reliable_msg *msg;
+  uint8_t i;
+
+  if (ctx->reliable_count == ANT_RELIABLE_QUEUE_SIZE)
+    return 0;
+
+  i = ctx->reliable_head + ctx->reliable_count;
+  if (i >= ANT_RELIABLE_QUEUE_SIZE)
+    i -= ANT_RELIABLE_QUEUE_SIZE;
+  msg = &ctx->reliable[i];
+
+  msg->addr = addr;
+  for (i = 0; i < 6; i++)
+    msg->data[i] = data[i];
+  msg->retries = 0;
+
+  if (++ctx->reliable_next_id == 0)  // 0 is reserved for "queue full"
+    ctx->reliable_next_id = 1;
+  msg->id = ctx->reliable_next_id;
+
+  if (++ctx->reliable_count == 1) {
+    ctx->reliable_wait = 0;
+    reliable_slot(ctx);
+  }
+
+  return msg->id;
+}
+
+// Number of reliable messages queued or in flight
+uint8_t ant_reliable_pending(ant_ctx *ctx)
+{
+  return ctx->reliable_count;
+}
+
+// Called on every TX opportunity: hands the head of the queue to the
+// module unless it is already there or still backing off. Returns TRUE if
+// a message was sent.
+uint8_t reliable_slot(ant_ctx *ctx)
+{
+  ant_reliable_msg *msg;
+
+  if (ctx->reliable_count == 0 || ctx->reliable_in_flight == TRUE)
+    return FALSE;
+
+  if (ctx->reliable_wait > 0) {
+    ctx->reliable_wait--;
+    return FALSE;
+  }
+
+  msg = &ctx->reliable[ctx->reliable_head];
+  ant_send_acknowledged_data(ctx, msg->addr, msg->data);
+  ctx->reliable_in_flight = TRUE;
+
+  return TRUE;
+}
+
+// EVENT_TRANSFER_TX_COMPLETED/FAILED for the message in flight, or a
+// failure when the channel closes or the module resets under it. Failures
+// are retried on the following slots with exponential backoff until
+// ANT_RELIABLE_MAX_RETRIES is used up.
+void reliable_result(ant_ctx *ctx, uint8_t code)
+{
+  ant_reliable_msg *msg = &ctx->reliable[ctx->reliable_head];
+  uint16_t wait;
+  uint8_t status;
+  uint8_t id;
+#if ANT_DEFERRED_QUEUE_SIZE > 0
+  uint8_t report[2];
+#endif
+
+  // Not ours: an ant_send_acknowledged_data() made by the application
+  if (ctx->reliable_in_flight == FALSE)
+    return;
+
+  ctx->reliable_in_flight = FALSE;
+
+  if (code == EVENT_TRANSFER_TX_FAILED &&
+      ++msg->retries <= ANT_RELIABLE_MAX_RETRIES)
+  {
+    wait = (msg->retries > 8) ? 0xff : (1 << (msg->retries - 1)) - 1;
+    if (wait > ANT_RELIABLE_MAX_BACKOFF)
+      wait = ANT_RELIABLE_MAX_BACKOFF;
+    ctx->reliable_wait = wait;
+    return;
+  }
+
+  status = (code == EVENT_TRANSFER_TX_COMPLETED) ? ANT_DELIVERY_OK
+                                                 : ANT_DELIVERY_FAILED;
+  id = msg->id;
+
+  if (++ctx->reliable_head == ANT_RELIABLE_QUEUE_SIZE)
+    ctx->reliable_head = 0;
+  ctx->reliable_count--;
+  ctx->reliable_wait = 0;
+
+  // Report last, so the callback is free to queue the next message
+#if ANT_DEFERRED_QUEUE_SIZE > 0
+  report[0] = id;
+  report[1] = status;
+  deferred_add(ctx, DEFERRED_DELIVERY, report, 2);
+#else
+  call_delivery(ctx, id, status);
+#endif
+}
+#endif
+
+#if ANT_PUBLISH
+// Replaces the value a master publishes. The driver sends it to the module
+// on every EVENT_TX, so the application never has to time its sends to the
+// channel period. Safe to call from interrupt handlers.
+void ant_publish(ant_ctx *ctx, uint16_t addr, uint8_t *data)
+{
+  uint8_t i;
+
+  ANT_ATOMIC
+  {
+    ctx->publish_addr = addr;
+    for (i = 0; i < 6; i++)
+      ctx->publish_data[i] = data[i];
+    ctx->publish_valid = TRUE;
+  }
+}
+
+// EVENT_TX: push the latest published value for the next channel period
+void publish_slot(ant_ctx *ctx)
+{
+  uint8_t data[6];
+  uint16_t addr;
+  uint8_t i;
+
+  if (ctx->publish_valid == FALSE)
+    return;
+
+  // Copy out first so interrupts aren't held off while the UART drains
+  ANT_ATOMIC
+  {
+    addr = ctx->publish_addr;
+    for (i = 0; i < 6; i++)
+      data[i] = ctx->publish_data[i];
+  }
+
+  ant_send_broadcast_data(ctx, addr, data);
+}
+#endif
+
+#if ANT_POLL_SLAVES > 0
+// Adds a slave address to the master's polling round. Returns FALSE if
+// the table is full. The poll table is only used from ant_handle_msg(), so
+// call this (and ant_poll_remove) from the same context.
+uint8_t ant_poll_add(ant_ctx *ctx, uint16_t addr)
+{
+  ant_poll_slave *slave;
+
+  if (ctx->poll_count == ANT_POLL_SLAVES)
+    return FALSE;
+
+  slave = &ctx->poll_slaves[ctx->poll_count++];
+  memset(slave, 0, sizeof(*slave));
+  slave->addr = addr;
+
+  return TRUE;
+}
+
+void ant_poll_remove(ant_ctx *ctx, uint16_t addr)
+{
+  uint8_t i;
+
+  for (i = 0; i < ctx->poll_count; i++)
+  {
+    if (ctx->poll_slaves[i].addr != addr)
+      continue;
+
+    ctx->poll_count--;
+    memmove(&ctx->poll_slaves[i], &ctx->poll_slaves[i + 1],
+            (ctx->poll_count - i) * sizeof(ant_poll_slave));
+
+    // Indices have moved, don't blame anyone for the poll in flight
+    ctx->poll_pending = FALSE;
+    if (ctx->poll_next >= ctx->poll_count)
+      ctx->poll_next = 0;
+    return;
+  }
+}
+
+// Polled slaves and their counters. The answer rate of a slave is
+// responses / polls.
+const ant_poll_slave *ant_poll_table(ant_ctx *ctx, uint8_t *count)
+{
+  *count = ctx->poll_count;
+  return ctx->poll_slaves;
+}
+
+// EVENT_TX: a slave answers in the period it was polled, so one that
+// hasn't by the next TX slot missed it. After ANT_POLL_DEAD_MISSES in a row
+// it is passed over for exponentially more turns, up to ANT_POLL_MAX_SKIP,
+// leaving its slots to the slaves that do answer.
+void poll_settle(ant_ctx *ctx)
+{
+  ant_poll_slave *slave;
+  uint8_t shift;
+
+  ctx->poll_clock++;
+
+  if (ctx->poll_pending == FALSE)
+    return;
+  ctx->poll_pending = FALSE;
+
+  slave = &ctx->poll_slaves[ctx->poll_current];
+  if (slave->misses < 255)
+    slave->misses++;
 
-  printf("MESG_BROADCAST_DATA_ID sent\n");
+  if (slave->misses >= ANT_POLL_DEAD_MISSES)
+  {
+    shift = slave->misses - ANT_POLL_DEAD_MISSES;
+    if (shift > 7)
+      shift = 7;
+    slave->skip = ((1 << shift) > ANT_POLL_MAX_SKIP) ?
+                  ANT_POLL_MAX_SKIP : (1 << shift);
+  }
 }
 
-void ant_send_acknowledged_data(uint16_t addr, uint8_t *data)
+// EVENT_TX: polls the next slave in the round that isn't being passed
+// over, with the published value as payload if there is one. Returns TRUE
+// if a poll was sent.
+uint8_t poll_slot(ant_ctx *ctx)
+{
+  ant_poll_slave *slave;
+  uint8_t data[6];
+  uint8_t i, n;
+
+  for (n = 0; n < ctx->poll_count; n++)
+  {
+    i = ctx->poll_next;
+    if (++ctx->poll_next == ctx->poll_count)
+      ctx->poll_next = 0;
+
+    slave = &ctx->poll_slaves[i];
+    if (slave->skip > 0)
+    {
+      slave->skip--;
+      continue;
+    }
+
+    memset(data, 0, sizeof(data));
+#if ANT_PUBLISH
+    ANT_ATOMIC
+    {
+      uint8_t j;
+
+      if (ctx->publish_valid == TRUE)
+        for (j = 0; j < 6; j++)
+          data[j] = ctx->publish_data[j];
+    }
+#endif
+
+    ant_send_broadcast_data(ctx, slave->addr, data);
+    slave->polls++;
+    ctx->poll_current = i;
+    ctx->poll_pending = TRUE;
+    return TRUE;
+  }
+
+  return FALSE;  // Nobody to poll this time
+}
+
+// A slave's data message reached the master
+void poll_response(ant_ctx *ctx, uint16_t addr)
+{
+  ant_poll_slave *slave;
+  uint8_t i;
+
+  for (i = 0; i < ctx->poll_count; i++)
+  {
+    slave = &ctx->poll_slaves[i];
+    if (slave->addr != addr)
+      continue;
+
+    slave->last_seen = ctx->poll_clock;
+    slave->misses = 0;
+    slave->skip = 0;
+    if (ctx->poll_pending == TRUE && ctx->poll_current == i)
+    {
+      slave->responses++;
+      ctx->poll_pending = FALSE;
+    }
+    return;
+  }
+}
+#endif
+
+void ant_send_acknowledged_data(ant_ctx *ctx, uint16_t addr, uint8_t *data)
 {
   uint8_t buf[13];
   
@@ -216,37 +1193,96 @@ void ant_send_acknowledged_data(uint16_t addr, uint8_t *data)
   buf[11] = data[5];
   buf[12] = checksum(buf, 12);
   
-  send_to_ant(buf, 13);
+  send_to_ant(ctx, buf, 13);
 
-  printf("MESG_ACKNOWLEDGED_DATA_ID sent\n");
+  ANT_LOG("MESG_ACKNOWLEDGED_DATA_ID sent\n");
 }
 
-void ant_config(void)
+void ant_config(ant_ctx *ctx)
 {
   uint8_t data[6];
+  uint8_t i;
+#if ANT_RX_META
+  uint8_t flags;
+#endif
 
-  if (_config.master == TRUE)
+  if (ctx->config.master == TRUE)
   {
-    assign_channel_id(0x30);  // Channel type (0x30 == shared transmit channel
+    assign_channel_id(ctx, 0x30);  // Channel type (0x30 == shared transmit channel
+#if ANT_SCAN
+  } else if (ctx->config.scan == TRUE) {
+    assign_channel_id(ctx, 0x00);  // Channel type (0x00 == receive channel, needed to scan
+#endif
   } else {
-    assign_channel_id(0x20);  // Channel type (0x20 == shared receive channel
+    assign_channel_id(ctx, 0x20);  // Channel type (0x20 == shared receive channel
+  }
+  ant_handle_msg(ctx);
+
+  set_channel_id(ctx);
+  ant_handle_msg(ctx);
+
+  // Let the radio drop devices we don't want before they reach the UART
+  if (ctx->config.master == FALSE && ctx->config.id_list_size > 0)
+  {
+    for (i = 0; i < ctx->config.id_list_size && i < ANT_ID_LIST_MAX; i++)
+    {
+      id_list_add(ctx, &ctx->config.id_list[i], i);
+      ant_handle_msg(ctx);
+    }
+
+    id_list_config(ctx, i, ctx->config.id_list_exclude);
+    ant_handle_msg(ctx);
   }
-  ant_handle_msg();
 
-  set_channel_id();
-  ant_handle_msg();
+  set_channel_period(ctx, ctx->period);
+  ant_handle_msg(ctx);
+
+  set_frequency(ctx, ctx->config.frequency);
+  ant_handle_msg(ctx);
+
+#if ANT_RX_META
+  // Have RSSI and timestamp appended to every data message, and in scan
+  // mode the sender's channel ID as well
+  flags = ANT_EXT_RSSI | ANT_EXT_TIMESTAMP;
+#if ANT_SCAN
+  if (ctx->config.scan == TRUE)
+    flags |= ANT_EXT_CHANNEL_ID;
+#endif
+  set_lib_config(ctx, flags);
+  ant_handle_msg(ctx);
+#endif
+
+#if ANT_SCAN
+  // The radio listens all the time, there's no search to time out and
+  // nothing to send
+  if (ctx->config.scan == TRUE)
+  {
+#if !ANT_RX_META
+    enable_ext_messages(ctx);
+    ant_handle_msg(ctx);
+#endif
+
+    open_rx_scan(ctx);
+    ant_handle_msg(ctx);
+    return;
+  }
+#endif
 
-  set_channel_period(_config.period);
-  ant_handle_msg();
+  // Only slaves search for the other end
+  if (ctx->config.master == FALSE)
+  {
+    set_lp_search_timeout(ctx, ANT_LP_SEARCH_TIMEOUT);
+    ant_handle_msg(ctx);
 
-  set_frequency(_config.frequency);
-  ant_handle_msg();
+    set_search_timeout(ctx, ANT_SEARCH_TIMEOUT);
+    ant_handle_msg(ctx);
+  }
 
-  open_channel();
-  ant_handle_msg();
+  open_channel(ctx);
+  ant_handle_msg(ctx);
 
   // If we're not a master, tell the ANT radio what our address is
-  if (_config.master == FALSE)
+  if (ctx->config.master == FALSE)
   {
     data[0] = 1;
     data[1] = 1;
@@ -255,23 +1291,83 @@ void ant_config(void)
     data[4] = 1;
     data[5] = 1;
     
-    ant_send_broadcast_data(_config.address, data);
+    ant_send_broadcast_data(ctx, ctx->config.address, data);
   }
 }
 
-void ant_init(ant_configuration config)
+void ant_init(ant_ctx *ctx, ant_configuration config)
 {
-  rb_init(&rx_ring, 255, buffer);
+  if (config.usart >= ANT_PORT_DEVICES)
+    return;
 
-  _config = config;
+  rb_init(&ctx->rx_ring, ANT_RX_RING_SIZE, ctx->rx_storage);
+#if ANT_RX_BUFFERS > 1
+  memset(ctx->rx_refs, 0, sizeof(ctx->rx_refs));
+  ctx->rx_cur = 0;
+  ctx->rx_buf = ctx->rx_pool[0];
+#endif
+  ctx->msg_n = 0;
+  ctx->in_msg = FALSE;
+  ctx->replay_pos = 0;
+  ctx->replay_end = 0;
+  ctx->rx_syncs = 0;
+  ctx->parsed_syncs = 0;
+  ctx->paired_state = PAIRED_NONE;
+#if ANT_RX_META
+  ctx->rx_meta.flags = 0;
+#endif
+#if ANT_DEFERRED_QUEUE_SIZE > 0
+  ctx->deferred_count = 0;
+  ctx->deferred_dropped = 0;
+  ctx->deferred_slots = 0;
+#endif
+#if ANT_SCAN
+  ctx->scan_count = 0;
+  ctx->scan_clock = 0;
+#endif
+  memset((void *)&ctx->stats, 0, sizeof(ctx->stats));
+#if ANT_PUBLISH
+  ctx->publish_valid = FALSE;
+#endif
+#if ANT_RELIABLE_QUEUE_SIZE > 0
+  ctx->reliable_head = 0;
+  ctx->reliable_count = 0;
+  ctx->reliable_in_flight = FALSE;
+#endif
+#if ANT_POLL_SLAVES > 0
+  ctx->poll_count = 0;
+  ctx->poll_next = 0;
+  ctx->poll_pending = FALSE;
+  ctx->poll_clock = 0;
+#endif
+
+  ctx->config = config;
+  ctx->period = config.period;
+#if ANT_ADAPTIVE_PERIOD
+  if (ctx->config.period_min == 0)
+    ctx->config.period_min = config.period;
+  if (ctx->config.period_max == 0)
+    ctx->config.period_max = config.period;
+  ctx->period_changed = FALSE;
+  ctx->period_slots = 0;
+  ctx->period_changes = 0;
+  ctx->period_backlog = FALSE;
+  ctx->period_fails = 0;
+  ctx->period_clean = 0;
+  ctx->period_hold = 1;
+  ctx->period_trying = FALSE;
+  memset(ctx->period_last, 0, sizeof(ctx->period_last));
+#endif
+
+  ant_port_attach(ctx);
   
-  reset();
-  delay_ms(600);
+  reset(ctx);
+  ant_port_delay_ms(600);
 
-  ant_config();
+  ant_config(ctx);
 }
 
-void reset(void)
+void reset(ant_ctx *ctx)
 {
   uint8_t buf[5];
   
@@ -281,31 +1377,13 @@ void reset(void)
   buf[3] = 0x00;                 // Data Byte N (N=Length)
   buf[4] = checksum(buf, 4);
   
-  send_to_ant(buf, 5);
+  send_to_ant(ctx, buf, 5);
 
-  printf("MESG_SYSTEM_RESET_ID sent\n");
+  ANT_LOG("MESG_SYSTEM_RESET_ID sent\n");
 }
 
 
-void get_capabilities(void)
-{
-  uint8_t buf[5];
-  
-  buf[0] = MESG_TX_SYNC;          // SYNC Byte
-  buf[1] = 0x02;                  // Length Byte
-  buf[2] = MESG_REQUEST_ID;       // ID Byte
-  buf[3] = CHAN0;                 // Channel
-  buf[4] = MESG_CAPABILITIES_ID;  // Data Byte N (N=Length)
-  buf[5] = checksum(buf, 5);
-  
-  send_to_ant(buf, 6);
-
-  printf("MESG_CAPABILITIES_ID sent\n");
-
-  ant_handle_msg();
-}
-
-void assign_channel_id(uint8_t type)
+void assign_channel_id(ant_ctx *ctx, uint8_t type)
 {
   uint8_t buf[7];
   
@@ -317,14 +1395,14 @@ void assign_channel_id(uint8_t type)
   buf[5] = NET0;                   // Network
   buf[6] = checksum(buf, 6);
   
-  send_to_ant(buf, 7);
+  send_to_ant(ctx, buf, 7);
 
-  printf("MESG_ASSIGN_CHANNEL_ID sent\n");
+  ANT_LOG("MESG_ASSIGN_CHANNEL_ID sent\n");
 
-  ant_handle_msg();
+  ant_handle_msg(ctx);
 }
 
-void set_channel_id(void)
+void set_channel_id(ant_ctx *ctx)
 {
   uint8_t buf[9];
   
@@ -332,20 +1410,79 @@ void set_channel_id(void)
   buf[1] = 0x05;               // Length Byte
   buf[2] = MESG_CHANNEL_ID_ID; // ID Byte
   buf[3] = CHAN0;              // Channel number
-  buf[4] = 0x01;               // Device id (2 bytes, little endian)
-  buf[5] = 0x00;
-  buf[6] = 0x03;               // Device type
-  buf[7] = 0x03;               // Transmission type
+  buf[4] = ctx->config.channel_id.device_number & 255;  // Device number
+  buf[5] = ctx->config.channel_id.device_number >> 8;   // (little endian)
+  buf[6] = ctx->config.channel_id.device_type;
+  buf[7] = ctx->config.channel_id.transmission_type;
   buf[8] = checksum(buf, 8);
 
-  send_to_ant(buf, 9);
+  send_to_ant(ctx, buf, 9);
 
-  printf("MESG_CHANNEL_ID_ID sent\n");
+  ANT_LOG("MESG_CHANNEL_ID_ID sent\n");
 
-  ant_handle_msg();
+  ant_handle_msg(ctx);
 }
 
-void timeout(uint8_t timeout)
+void id_list_add(ant_ctx *ctx, ant_channel_id *id, uint8_t index)
+{
+  uint8_t buf[10];
+  
+  buf[0] = MESG_TX_SYNC;          // SYNC Byte
+  buf[1] = 0x06;                  // Length Byte
+  buf[2] = MESG_ID_LIST_ADD_ID;   // ID Byte
+  buf[3] = CHAN0;                 // Channel number
+  buf[4] = id->device_number & 255;
+  buf[5] = id->device_number >> 8;
+  buf[6] = id->device_type;
+  buf[7] = id->transmission_type;
+  buf[8] = index;                 // List index (0-3)
+  buf[9] = checksum(buf, 9);
+
+  send_to_ant(ctx, buf, 10);
+
+  ANT_LOG("MESG_ID_LIST_ADD_ID sent\n");
+
+  ant_handle_msg(ctx);
+}
+
+void id_list_config(ant_ctx *ctx, uint8_t size, uint8_t exclude)
+{
+  uint8_t buf[7];
+  
+  buf[0] = MESG_TX_SYNC;           // SYNC Byte
+  buf[1] = 0x03;                   // Length Byte
+  buf[2] = MESG_ID_LIST_CONFIG_ID; // ID Byte
+  buf[3] = CHAN0;                  // Channel number
+  buf[4] = size;                   // Entries in use
+  buf[5] = exclude;                // 0 = inclusion list, 1 = exclusion list
+  buf[6] = checksum(buf, 6);
+
+  send_to_ant(ctx, buf, 7);
+
+  ANT_LOG("MESG_ID_LIST_CONFIG_ID sent\n");
+
+  ant_handle_msg(ctx);
+}
+
+// The module answers with a MESG_CHANNEL_ID_ID message, which the main
+// loop picks up like any other
+void request_channel_id(ant_ctx *ctx)
+{
+  uint8_t buf[6];
+  
+  buf[0] = MESG_TX_SYNC;          // SYNC Byte
+  buf[1] = 0x02;                  // Length Byte
+  buf[2] = MESG_REQUEST_ID;       // ID Byte
+  buf[3] = CHAN0;                 // Channel
+  buf[4] = MESG_CHANNEL_ID_ID;    // Requested message
+  buf[5] = checksum(buf, 5);
+  
+  send_to_ant(ctx, buf, 6);
+
+  ANT_LOG("MESG_REQUEST_ID (channel id) sent\n");
+}
+
+void set_search_timeout(ant_ctx *ctx, uint8_t timeout)
 {
   uint8_t buf[6];
   
@@ -356,14 +1493,32 @@ void timeout(uint8_t timeout)
   buf[4] = timeout;
   buf[5] = checksum(buf, 5);
 
-  send_to_ant(buf, 6);
+  send_to_ant(ctx, buf, 6);
 
-  printf("MESG_CHANNEL_SEARCH_TIMEOUT_ID sent\n");
+  ANT_LOG("MESG_CHANNEL_SEARCH_TIMEOUT_ID sent\n");
 
-  ant_handle_msg();
+  ant_handle_msg(ctx);
 }
 
-void set_frequency(uint8_t frequency)
+void set_lp_search_timeout(ant_ctx *ctx, uint8_t timeout)
+{
+  uint8_t buf[6];
+  
+  buf[0] = MESG_TX_SYNC;                  // SYNC Byte
+  buf[1] = 0x02;                          // Length Byte
+  buf[2] = MESG_SET_LP_SEARCH_TIMEOUT_ID; // ID Byte
+  buf[3] = CHAN0;                         // Channel
+  buf[4] = timeout;
+  buf[5] = checksum(buf, 5);
+
+  send_to_ant(ctx, buf, 6);
+
+  ANT_LOG("MESG_SET_LP_SEARCH_TIMEOUT_ID sent\n");
+
+  ant_handle_msg(ctx);
+}
+
+void set_frequency(ant_ctx *ctx, uint8_t frequency)
 {
   uint8_t buf[6];
   
@@ -374,14 +1529,14 @@ void set_frequency(uint8_t frequency)
   buf[4] = frequency;
   buf[5] = checksum(buf,5);
 
-  send_to_ant(buf, 6);
+  send_to_ant(ctx, buf, 6);
 
-  printf("MESG_CHANNEL_RADIO_FREQ_ID sent\n");
+  ANT_LOG("MESG_CHANNEL_RADIO_FREQ_ID sent\n");
 
-  ant_handle_msg();
+  ant_handle_msg(ctx);
 }
 
-void set_channel_period(uint16_t period)
+void set_channel_period(ant_ctx *ctx, uint16_t period)
 {
   uint8_t buf[7];
   
@@ -393,14 +1548,14 @@ void set_channel_period(uint16_t period)
   buf[5] = period >> 8;                 // MSB
   buf[6] = checksum(buf, 6);
 
-  send_to_ant(buf, 7);
+  send_to_ant(ctx, buf, 7);
 
-  printf("MESG_CHANNEL_MESG_PERIOD_ID sent\n");
+  ANT_LOG("MESG_CHANNEL_MESG_PERIOD_ID sent\n");
 
-  ant_handle_msg();
+  ant_handle_msg(ctx);
 }
 
-void open_channel(void)
+void open_channel(ant_ctx *ctx)
 {
   uint8_t buf[5];
   
@@ -410,25 +1565,362 @@ void open_channel(void)
   buf[3] = CHAN0;                // Channel
   buf[4] = checksum(buf, 4);
 
-  send_to_ant(buf, 5);
+  send_to_ant(ctx, buf, 5);
+
+  ANT_LOG("MESG_OPEN_CHANNEL_ID sent\n");
+
+  ant_handle_msg(ctx);
+}
+
+#if ANT_RX_META
+// Chooses the extended fields (ANT_EXT_*) appended to every data message
+void set_lib_config(ant_ctx *ctx, uint8_t flags)
+{
+  uint8_t buf[6];
+  
+  buf[0] = MESG_TX_SYNC;                // SYNC Byte
+  buf[1] = MESG_LIB_CONFIG_SIZE;        // Length Byte
+  buf[2] = MESG_LIB_CONFIG_ID;          // ID Byte
+  buf[3] = 0x00;                        // Filler
+  buf[4] = flags;
+  buf[5] = checksum(buf, 5);
+
+  send_to_ant(ctx, buf, 6);
+
+  ANT_LOG("MESG_LIB_CONFIG_ID sent\n");
+
+  ant_handle_msg(ctx);
+}
+#endif
+
+#if ANT_SCAN
+#if !ANT_RX_META
+// Appends the sender's channel ID to every data message
+void enable_ext_messages(ant_ctx *ctx)
+{
+  uint8_t buf[6];
+  
+  buf[0] = MESG_TX_SYNC;                // SYNC Byte
+  buf[1] = 0x02;                        // Length Byte
+  buf[2] = MESG_RX_EXT_MESGS_ENABLE_ID; // ID Byte
+  buf[3] = 0x00;                        // Filler
+  buf[4] = 0x01;                        // Enable
+  buf[5] = checksum(buf, 5);
+
+  send_to_ant(ctx, buf, 6);
+
+  ANT_LOG("MESG_RX_EXT_MESGS_ENABLE_ID sent\n");
+
+  ant_handle_msg(ctx);
+}
+#endif
+
+void open_rx_scan(ant_ctx *ctx)
+{
+  uint8_t buf[5];
+  
+  buf[0] = MESG_TX_SYNC;          // SYNC Byte
+  buf[1] = 0x01;                  // Length Byte
+  buf[2] = MESG_OPEN_RX_SCAN_ID;  // ID Byte
+  buf[3] = 0x00;                  // Filler
+  buf[4] = checksum(buf, 4);
+
+  send_to_ant(ctx, buf, 5);
+
+  ANT_LOG("MESG_OPEN_RX_SCAN_ID sent\n");
+
+  ant_handle_msg(ctx);
+}
+#endif
+
+#if ANT_RX_BUFFERS > 1
+// Keeps the message passed to callback_broadcast_recv after the callback
+// returns, so it can be used later without a copy. Call it from inside the
+// callback; the parser moves on to another buffer. Every hold needs an
+// ant_frame_release() from the same context as ant_handle_msg(). While all
+// buffers are held nothing is parsed. Returns FALSE if buf is not the
+// message being delivered (e.g. a deferred callback's copy).
+uint8_t ant_frame_hold(ant_ctx *ctx, const uint8_t *buf)
+{
+  int8_t i = rx_buffer_index(ctx, buf);
+
+  if (i != ctx->rx_cur || ctx->msg_n != 0 || ctx->rx_refs[i] == 0xFF)
+    return FALSE;
+
+  ctx->rx_refs[i]++;
+  return TRUE;
+}
+
+void ant_frame_release(ant_ctx *ctx, const uint8_t *buf)
+{
+  int8_t i = rx_buffer_index(ctx, buf);
+
+  if (i >= 0 && ctx->rx_refs[i] > 0)
+    ctx->rx_refs[i]--;
+}
+
+// Buffer holding buf, or -1
+int8_t rx_buffer_index(ant_ctx *ctx, const uint8_t *buf)
+{
+  uint8_t i;
 
-  printf("MESG_OPEN_CHANNEL_ID sent\n");
+  for (i = 0; i < ANT_RX_BUFFERS; i++)
+  {
+    if (buf >= ctx->rx_pool[i] && buf < ctx->rx_pool[i] + ANT_RX_MSG_SIZE)
+      return i;
+  }
 
-  ant_handle_msg();
+  return -1;
 }
 
-void send_to_ant(uint8_t* buffer, uint8_t len)
+// Makes sure the parser has a buffer nobody holds, switching if the
+// current one was kept. Returns FALSE if all of them are held.
+uint8_t rx_buffer_ready(ant_ctx *ctx)
 {
   uint8_t i;
 
-  for(i = 0; i < len; i++) {
-    uart_putchar(buffer[i]);
+  if (ctx->rx_refs[ctx->rx_cur] == 0)
+    return TRUE;
+
+  for (i = 0; i < ANT_RX_BUFFERS; i++)
+  {
+    if (ctx->rx_refs[i] == 0)
+      break;
   }
+  if (i == ANT_RX_BUFFERS)
+    return FALSE;
+
+  // Bytes of a bogus message still to be re-parsed move along
+  memcpy(ctx->rx_pool[i] + ctx->replay_pos, ctx->rx_buf + ctx->replay_pos,
+         ctx->replay_end - ctx->replay_pos);
+  ctx->rx_cur = i;
+  ctx->rx_buf = ctx->rx_pool[i];
+  return TRUE;
 }
+#endif
 
-void uart_putchar(char c) {
-  while ( !( UCSR0A & (1<<UDRE0)) );
-  UDR0 = c;
+// The driver's use of a master's TX slot, after the application's
+// callback_event_tx. A pending acknowledged message takes the slot over
+// the published value, which goes out again on the next one. Until its
+// result comes nothing else is sent, the module would send that instead.
+void tx_slot(ant_ctx *ctx)
+{
+#if ANT_RELIABLE_QUEUE_SIZE > 0
+  if (ctx->reliable_in_flight == TRUE || reliable_slot(ctx) == TRUE)
+    return;
+#endif
+#if ANT_POLL_SLAVES > 0
+  if (poll_slot(ctx) == TRUE)
+    return;
+#endif
+#if ANT_PUBLISH
+  publish_slot(ctx);
+#endif
+}
+
+// A slave's only chance to transmit is in reply to the master, so a
+// received message is its TX slot. Going after callback_broadcast_recv
+// means a pending acknowledged message wins over anything it just sent.
+void rx_slot(ant_ctx *ctx)
+{
+#if ANT_RELIABLE_QUEUE_SIZE > 0
+  reliable_slot(ctx);
+#endif
+}
+
+#if ANT_DEFERRED_QUEUE_SIZE > 0
+// Queues a callback for ant_run_deferred(). A full queue loses its least
+// urgent entry, the newest of them, or the new one if nothing is less
+// urgent than that.
+void deferred_add(ant_ctx *ctx, uint8_t kind, const uint8_t *buf,
+                  uint8_t len)
+{
+  ant_deferred *item;
+  uint8_t i, victim = 0;
+
+  if (ctx->deferred_count == ANT_DEFERRED_QUEUE_SIZE)
+  {
+    ctx->deferred_dropped++;
+
+    for (i = 1; i < ctx->deferred_count; i++)
+    {
+      if (ctx->deferred[i].kind >= ctx->deferred[victim].kind)
+        victim = i;
+    }
+    if (ctx->deferred[victim].kind <= kind)
+      return;
+
+    ctx->deferred_count--;
+    memmove(&ctx->deferred[victim], &ctx->deferred[victim + 1],
+            (ctx->deferred_count - victim) * sizeof(ant_deferred));
+  }
+
+  // Broadcasts are kept up to the data, anything the module appended is
+  // in rx_meta
+  if (len > sizeof(item->buf))
+    len = sizeof(item->buf);
+
+  item = &ctx->deferred[ctx->deferred_count++];
+  item->kind = kind;
+  item->slots = 0;
+  item->len = len;
+  if (len > 0)
+    memcpy(item->buf, buf, len);
+#if ANT_RX_META
+  item->meta = ctx->rx_meta;
+#endif
+}
+
+// Runs callbacks queued while parsing: EVENT_TX first, then delivery
+// reports, then broadcasts, each kind in arrival order. Call it from the
+// main loop after ant_handle_msg(). Runs at most max of them, and after
+// the first stops early once the module has sent more bytes, so parsing
+// never waits behind the application for long. The driver takes its
+// share of a TX slot as soon as the callbacks queued up to it have run, as
+// dispatch does after an immediate callback, so nothing they sent
+// overwrites it. Returns how many ran.
+uint8_t ant_run_deferred(ant_ctx *ctx, uint8_t max)
+{
+  ant_deferred item;
+  uint8_t i, next, n = 0;
+
+  // Slots whose callbacks were dropped
+  deferred_slots_run(ctx);
+
+  while (ctx->deferred_count > 0 && n < max)
+  {
+    if (n > 0 && rb_count(&ctx->rx_ring) > 0)
+      break;
+
+    next = 0;
+    for (i = 1; i < ctx->deferred_count; i++)
+    {
+      if (ctx->deferred[i].kind < ctx->deferred[next].kind)
+        next = i;
+    }
+
+    // Take it off the queue first, the callback may cause new entries
+    item = ctx->deferred[next];
+    ctx->deferred_count--;
+    memmove(&ctx->deferred[next], &ctx->deferred[next + 1],
+            (ctx->deferred_count - next) * sizeof(ant_deferred));
+
+    switch (item.kind)
+    {
+      case DEFERRED_EVENT_TX:
+        call_event_tx(ctx);
+        break;
+#if ANT_RELIABLE_QUEUE_SIZE > 0
+      case DEFERRED_DELIVERY:
+        call_delivery(ctx, item.buf[0], item.buf[1]);
+        break;
+#endif
+      case DEFERRED_BROADCAST:
+#if ANT_RX_META
+        ctx->rx_meta = item.meta;
+#endif
+        call_broadcast_recv(ctx, item.buf, item.len);
+        break;
+    }
+    n++;
+
+    if (item.slots != 0)
+      deferred_slots_run(ctx);
+  }
+
+  return n;
+}
+
+// A TX slot came in: the driver uses it after the callbacks queued so far
+void deferred_slot(ant_ctx *ctx, uint8_t slot)
+{
+  uint8_t i;
+
+  for (i = 0; i < ctx->deferred_count; i++)
+    ctx->deferred[i].slots |= slot;
+  ctx->deferred_slots |= slot;
+}
+
+// Uses the TX slots that no queued callback is holding up any more
+void deferred_slots_run(ant_ctx *ctx)
+{
+  uint8_t i, ready = ctx->deferred_slots;
+
+  for (i = 0; i < ctx->deferred_count; i++)
+    ready &= ~ctx->deferred[i].slots;
+  ctx->deferred_slots &= ~ready;
+
+  if (ready & DEFERRED_SLOT_TX)
+    tx_slot(ctx);
+  if (ready & DEFERRED_SLOT_RX)
+    rx_slot(ctx);
+}
+
+// Callbacks lost because the queue was full
+uint16_t ant_deferred_dropped(ant_ctx *ctx)
+{
+  return ctx->deferred_dropped;
+}
+#endif
+
+void send_to_ant(ant_ctx *ctx, uint8_t* buffer, uint8_t len)
+{
+  frame_hook(ctx, ANT_FRAME_TX, buffer, len);
+  ant_port_write(ctx->config.usart, buffer, len);
+}
+
+// Application callbacks, bound at compile time or through the config
+static inline void call_event_tx(ant_ctx *ctx)
+{
+#if defined(ANT_CALLBACK_EVENT_TX)
+  ANT_CALLBACK_EVENT_TX(ctx);
+#else
+  if (ctx->config.callback_event_tx > 0)
+  {
+    ctx->config.callback_event_tx(ctx);
+  }
+#endif
+}
+
+static inline void call_broadcast_recv(ant_ctx *ctx, uint8_t *buf,
+                                       uint8_t len)
+{
+#if defined(ANT_CALLBACK_BROADCAST_RECV)
+  ANT_CALLBACK_BROADCAST_RECV(ctx, buf, len);
+#else
+  if (ctx->config.callback_broadcast_recv > 0)
+  {
+    ctx->config.callback_broadcast_recv(ctx, buf, len);
+  }
+#endif
+}
+
+#if ANT_RELIABLE_QUEUE_SIZE > 0
+static inline void call_delivery(ant_ctx *ctx, uint8_t id, uint8_t status)
+{
+#if defined(ANT_CALLBACK_DELIVERY)
+  ANT_CALLBACK_DELIVERY(ctx, id, status);
+#else
+  if (ctx->config.callback_delivery > 0)
+  {
+    ctx->config.callback_delivery(ctx, id, status);
+  }
+#endif
+}
+#endif
+
+// Shows a message to the frame callback, if there is one
+static inline void frame_hook(ant_ctx *ctx, uint8_t dir, const uint8_t *buf,
+                              uint8_t len)
+{
+#if defined(ANT_CALLBACK_FRAME)
+  ANT_CALLBACK_FRAME(ctx, dir, buf, len);
+#else
+  if (ctx->config.callback_frame > 0)
+  {
+    ctx->config.callback_frame(ctx, dir, buf, len);
+  }
+#endif
 }
 
 uint8_t checksum(uint8_t *data, uint8_t length)
@@ -441,16 +1933,3 @@ uint8_t checksum(uint8_t *data, uint8_t length)
   
   return chksum;
 }
-
-//General short delays
-void delay_ms(uint16_t x) {
-  uint8_t y, z;
-
-  for ( ; x > 0 ; x--) {
-    for ( y = 0 ; y < 90 ; y++) {
-      for ( z = 0 ; z < 6 ; z++) {
-        asm volatile ("nop");
-      }
-    }
-  }
-}
@@ -1,4 +1,12 @@
+#ifndef ANT_H
+#define ANT_H
+
 #include <stdio.h>
+#include <stdint.h>
+
+#include "ant_config.h"
+#include "ring_buffer.h"
+#include "ant_trace.h"
 
 #if !defined(UCHAR)
   #define UCHAR unsigned char
@@ -18,6 +26,11 @@
 #define MESG_FRAME_SIZE                   (MESG_HEADER_SIZE + MESG_CHECKSUM_SIZE)
 #define MESG_MAX_SIZE                     (MESG_MAX_DATA_SIZE + MESG_FRAME_SIZE)
 
+// A broadcast with every extended field (flags, channel ID, RSSI,
+// timestamp) is longer than any standard message
+#define MESG_EXT_MAX_DATA_SIZE            ((UCHAR)(1 + 8 + 1 + 4 + 3 + 2))
+#define MESG_EXT_MAX_SIZE                 (MESG_EXT_MAX_DATA_SIZE + MESG_FRAME_SIZE)
+
 //////////////////////////////////////////////
 // Message ID's
 //////////////////////////////////////////////
@@ -63,6 +76,8 @@
 #define MESG_SERIAL_NUM_SET_CHANNEL_ID_ID ((UCHAR)0x65)
 #define MESG_RX_EXT_MESGS_ENABLE_ID       ((UCHAR)0x66)
 #define MESG_RADIO_CONFIG_ALWAYS_ID       ((UCHAR)0x67)
+#define MESG_LIB_CONFIG_ID                ((UCHAR)0x6E)
+#define MESG_STARTUP_MESG_ID              ((UCHAR)0x6F)
 #define MESG_ENABLE_LED_FLASH_ID          ((UCHAR)0x68)
 #define MESG_AGC_CONFIG_ID                ((UCHAR)0x6A)
 #define MESG_READ_SEGA_ID                 ((UCHAR)0xA0)
@@ -130,6 +145,7 @@
 #define MESG_EXT_DATA_SIZE                ((UCHAR)13)
 #define MESG_RADIO_CONFIG_ALWAYS_SIZE     ((UCHAR)2)
 #define MESG_RX_EXT_MESGS_ENABLE_SIZE     ((UCHAR)2)
+#define MESG_LIB_CONFIG_SIZE              ((UCHAR)2)
 #define MESG_SET_TX_SEARCH_ON_NEXT_SIZE   ((UCHAR)2)
 #define MESG_SET_LP_SEARCH_TIMEOUT_SIZE   ((UCHAR)2)
 #define MESG_SERIAL_NUM_SET_CHANNEL_ID_SIZE ((UCHAR)3)
@@ -195,22 +211,322 @@
 #define TRUE	1
 #define FALSE	0
 
+// Delivery status reported for ant_send_reliable() messages
+#define ANT_DELIVERY_OK       0
+#define ANT_DELIVERY_FAILED   1  // Retries used up
+
+// Direction of a message passed to the frame callback
+#define ANT_FRAME_RX          0  // From the module
+#define ANT_FRAME_TX          1  // To the module
+
+typedef struct ant_ctx ant_ctx;
+
+// Driver counters, see ant_get_stats()
+typedef struct ant_stats
+{
+  uint32_t rx_bytes;           // Bytes received from the module
+  uint32_t rx_frames;          // Messages with a good checksum
+  uint16_t checksum_errors;
+  uint16_t length_errors;      // Length byte too big, i.e. a false sync
+  uint16_t ring_overflows;     // Bytes dropped because the RX ring was full
+  uint16_t rx_fails;           // EVENT_RX_FAIL
+  uint16_t search_timeouts;    // EVENT_RX_SEARCH_TIMEOUT
+  uint16_t reopens;            // Channel re-opened after the module closed it
+  uint8_t ring_high_water;     // Most bytes seen waiting in the RX ring
+  uint8_t max_frames_pending;  // Most messages seen queued behind another
+} ant_stats;
+
+// Binary dump of ant_stats produced by ant_stats_frame()
+#define ANT_STATS_MESG_ID    ((UCHAR)0xF0)
+#define ANT_STATS_DATA_SIZE  ((UCHAR)22)
+#define ANT_STATS_FRAME_SIZE (ANT_STATS_DATA_SIZE + MESG_FRAME_SIZE)
+
+// Acknowledged message waiting for delivery
+typedef struct ant_reliable_msg
+{
+  uint16_t addr;
+  uint8_t data[6];
+  uint8_t id;                // Handle returned by ant_send_reliable()
+  uint8_t retries;           // Failed attempts so far
+} ant_reliable_msg;
+
+#if ANT_POLL_SLAVES > 0
+// A slave on a shared channel, polled by the master
+typedef struct ant_poll_slave
+{
+  uint16_t addr;
+  uint16_t polls;            // Polls sent to it
+  uint16_t responses;        // Polls it answered
+  uint16_t last_seen;        // Poll clock at its last answer
+  uint8_t misses;            // Polls missed in a row
+  uint8_t skip;              // Turns to pass it over while it looks dead
+} ant_poll_slave;
+#endif
+
+// Channel ID the module pairs on. On a slave any field may be 0 to match
+// every device (wildcard). Bit 7 of device_type is the pairing bit.
+typedef struct ant_channel_id
+{
+  uint16_t device_number;
+  uint8_t device_type;
+  uint8_t transmission_type;
+} ant_channel_id;
+
+// Entries in the module's ID list (inclusion/exclusion list)
+#define ANT_ID_LIST_MAX       4
+
+// Flag byte of flagged extended messages: which fields follow the 8 data
+// bytes, in this order. Also the MESG_LIB_CONFIG_ID bits asking for them.
+#define ANT_EXT_CHANNEL_ID    0x80  // 4 bytes: the sender's channel ID
+#define ANT_EXT_RSSI          0x40  // 3 bytes: type, RSSI, threshold
+#define ANT_EXT_TIMESTAMP     0x20  // 2 bytes: RX time in 1/32768s
+
+#if ANT_RX_META
+// What the module told us about a received broadcast, see ant_get_rx_meta()
+typedef struct ant_rx_meta
+{
+  uint8_t flags;             // ANT_EXT_* fields that are valid
+  ant_channel_id id;
+  int8_t rssi;               // dBm
+  int8_t threshold;          // Search threshold in dBm
+  uint16_t timestamp;        // Module clock, wraps every 2s
+} ant_rx_meta;
+#endif
+
+#if ANT_SCAN
+// Latest message heard from one transmitter in scan mode
+typedef struct ant_scan_device
+{
+  ant_channel_id id;
+  uint8_t data[8];
+  uint16_t messages;         // Messages received from it
+  uint16_t last_seen;        // Scan clock at the last one
+#if ANT_RX_META
+  int8_t rssi;               // dBm of the last message, if the module sent it
+  uint16_t timestamp;        // Module clock at the last message
+#endif
+} ant_scan_device;
+#endif
+
+#if ANT_DEFERRED_QUEUE_SIZE > 0
+// Callback waiting for ant_run_deferred()
+typedef struct ant_deferred
+{
+  uint8_t kind;              // What to call, also its priority (0 first)
+  uint8_t slots;             // Driver TX slots waiting for it to run
+  uint8_t len;
+  uint8_t buf[3 + 9];        // Broadcast up to the checksum, or id/status
+#if ANT_RX_META
+  ant_rx_meta meta;
+#endif
+} ant_deferred;
+#endif
+
 // ANT radio configuration struct
 typedef struct ant_configuration
 {
   // Radio Settings
+  uint8_t usart;             // USART the module is wired to (0 or 1)
   uint8_t master;            // Is this radio a master?
   uint8_t address;           // Address for data messages
   uint16_t period;
   uint8_t frequency;
+  ant_channel_id channel_id;
+#if ANT_ADAPTIVE_PERIOD
+  // Bounds for the adaptive period, 0 means period. The period only moves
+  // in powers of two from period within these bounds, so the master's
+  // period is always a multiple or a fraction of a slave's.
+  // period_min is ignored by slaves, which never go faster than period.
+  uint16_t period_min;
+  uint16_t period_max;
+#endif
+
+  // Slave only: devices the module accepts while searching with wildcards
+  // (or rejects, if id_list_exclude is TRUE). Filtering in the radio keeps
+  // unwanted traffic off the UART. An id_list_size of 0 disables the list.
+  ant_channel_id id_list[ANT_ID_LIST_MAX];
+  uint8_t id_list_size;
+  uint8_t id_list_exclude;
+#if ANT_SCAN
+  uint8_t scan;              // Slave only: receive from every transmitter
+#endif
 
   // Callbacks
-  void (*callback_event_tx)(void);
-  void (*callback_broadcast_recv)(uint8_t *buf, uint8_t len);
+  void (*callback_event_tx)(ant_ctx *ctx);
+  void (*callback_broadcast_recv)(ant_ctx *ctx, uint8_t *buf, uint8_t len);
+  void (*callback_delivery)(ant_ctx *ctx, uint8_t id, uint8_t status);
+#if ANT_SCAN
+  void (*callback_scan_recv)(ant_ctx *ctx, ant_scan_device *dev);
+#endif
+  // Every message with a good checksum received, and every message sent,
+  // as raw bytes from sync to checksum. Meant for capturing traffic.
+  void (*callback_frame)(ant_ctx *ctx, uint8_t dir, const uint8_t *buf,
+                         uint8_t len);
 } ant_configuration;
 
+// Driver context, one per ANT module. Allocate one (statically) for each
+// radio and pass it to every call; the fields are private to ant.c.
+struct ant_ctx
+{
+  ant_configuration config;
+
+  // Message parser
+#if ANT_RX_BUFFERS > 1
+  uint8_t rx_pool[ANT_RX_BUFFERS][ANT_RX_MSG_SIZE];
+  uint8_t rx_refs[ANT_RX_BUFFERS];  // ant_frame_hold() count per buffer
+  uint8_t rx_cur;            // Buffer the parser fills
+  uint8_t *rx_buf;           // rx_pool[rx_cur]
+#else
+  uint8_t rx_buf[ANT_RX_MSG_SIZE];
+#endif
+  uint8_t msg_n;
+  uint8_t in_msg;
+  uint8_t replay_pos;        // Bytes of a bogus message being re-parsed,
+  uint8_t replay_end;        // see resync()
+
+  // RX ring, filled by the USART interrupt
+  volatile ring_buffer rx_ring;
+  uint8_t rx_storage[ANT_RX_RING_SIZE];
+
+  // Statistics. Sync bytes are counted in and out of the ring to tell how
+  // many messages are queued.
+  volatile ant_stats stats;
+  volatile uint8_t rx_syncs;
+  uint8_t parsed_syncs;
+
+  // Channel ID of the device a slave is tracking, asked of the module on
+  // the first message after the channel opens
+  ant_channel_id paired_id;
+  uint8_t paired_state;
+
+#if ANT_RX_META
+  // Extended fields of the broadcast being dispatched
+  ant_rx_meta rx_meta;
+#endif
+
+#if ANT_SCAN
+  // Transmitters heard in scan mode. The clock counts extended messages
+  // and tells which device was heard from least recently.
+  ant_scan_device scan_devices[ANT_SCAN_DEVICES];
+  uint8_t scan_count;
+  uint16_t scan_clock;
+#endif
+
+#if ANT_TRACE
+  // Timer1 stamps of the sync bytes in the ring, indexed by rx_syncs
+  volatile uint16_t sync_stamps[ANT_TRACE_STAMPS];
+  uint16_t frame_stamp;      // Sync of the message being parsed
+  uint8_t frame_stamp_valid;
+  uint16_t parsed_stamp;     // Checksum of the last message completed
+#endif
+
+#if ANT_PUBLISH
+  // Latest value a master sends on each EVENT_TX, written by ant_publish()
+  volatile uint8_t publish_data[6];
+  volatile uint16_t publish_addr;
+  volatile uint8_t publish_valid;
+#endif
+
+#if ANT_RELIABLE_QUEUE_SIZE > 0
+  // Reliable delivery queue, the head is the message in flight
+  ant_reliable_msg reliable[ANT_RELIABLE_QUEUE_SIZE];
+  uint8_t reliable_head;
+  uint8_t reliable_count;
+  uint8_t reliable_in_flight;
+  uint8_t reliable_wait;     // TX slots to skip before the next attempt
+  uint8_t reliable_next_id;
+#endif
+
+  uint16_t period;           // Channel period in use
+
+#if ANT_ADAPTIVE_PERIOD
+  // Payload changes and backlog (master) or empty slots (slave) seen in
+  // the current window
+  uint8_t period_last[6];
+  uint8_t period_changed;
+  uint8_t period_slots;
+  uint8_t period_changes;
+  uint8_t period_backlog;
+  uint8_t period_fails;
+  uint8_t period_clean;      // Windows without a fail in a row
+  uint8_t period_hold;       // Clean windows before a slave speeds up
+  uint8_t period_trying;     // The last window sped it up
+#endif
+
+#if ANT_POLL_SLAVES > 0
+  // Shared channel polling. The clock counts EVENT_TX.
+  ant_poll_slave poll_slaves[ANT_POLL_SLAVES];
+  uint8_t poll_count;
+  uint8_t poll_next;         // Where the round robin carries on
+  uint8_t poll_current;      // Slave polled on the last TX slot
+  uint8_t poll_pending;      // ...and it hasn't answered yet
+  uint16_t poll_clock;
+#endif
+
+#if ANT_DEFERRED_QUEUE_SIZE > 0
+  // Callbacks queued by dispatch, in arrival order
+  ant_deferred deferred[ANT_DEFERRED_QUEUE_SIZE];
+  uint8_t deferred_count;
+  uint16_t deferred_dropped;
+  uint8_t deferred_slots;    // TX slots the driver hasn't used yet
+#endif
+};
+
+// Queues one byte received from the module for ant_handle_msg(). Called by
+// the port layer, from the RX interrupt on the AVR, so it is kept inline
+// and short.
+static inline void ant_rx_byte(ant_ctx *ctx, uint8_t byte)
+{
+  if (!ctx)
+    return;
+
+  ctx->stats.rx_bytes++;
+
+  if (rb_push(&ctx->rx_ring, byte) == 0) {
+    ctx->stats.ring_overflows++;
+  } else if (byte == MESG_TX_SYNC) {
+#if ANT_TRACE
+    ctx->sync_stamps[ctx->rx_syncs & (ANT_TRACE_STAMPS - 1)] = ant_trace_now();
+#endif
+    ctx->rx_syncs++;
+  }
+}
+
 // Public Functions
-void ant_init(ant_configuration config);
-void ant_handle_msg(void);
-void ant_send_broadcast_data(uint16_t addr, uint8_t *data);
-void ant_send_acknowledged_data(uint16_t addr, uint8_t *data);
\ No newline at end of file
+void ant_init(ant_ctx *ctx, ant_configuration config);
+void ant_handle_msg(ant_ctx *ctx);
+void ant_feed(ant_ctx *ctx, const uint8_t *buf, uint16_t len);
+void ant_send_broadcast_data(ant_ctx *ctx, uint16_t addr, uint8_t *data);
+void ant_send_acknowledged_data(ant_ctx *ctx, uint16_t addr, uint8_t *data);
+void ant_get_stats(ant_ctx *ctx, ant_stats *stats);
+uint8_t ant_stats_frame(ant_ctx *ctx, uint8_t *buf);
+uint8_t ant_get_paired_id(ant_ctx *ctx, ant_channel_id *id);
+uint16_t ant_get_period(ant_ctx *ctx);
+#if ANT_RX_META
+const ant_rx_meta *ant_get_rx_meta(ant_ctx *ctx);
+#endif
+#if ANT_SCAN
+const ant_scan_device *ant_scan_table(ant_ctx *ctx, uint8_t *count);
+#endif
+#if ANT_PUBLISH
+void ant_publish(ant_ctx *ctx, uint16_t addr, uint8_t *data);
+#endif
+#if ANT_RELIABLE_QUEUE_SIZE > 0
+uint8_t ant_send_reliable(ant_ctx *ctx, uint16_t addr, uint8_t *data);
+uint8_t ant_reliable_pending(ant_ctx *ctx);
+#endif
+#if ANT_POLL_SLAVES > 0
+uint8_t ant_poll_add(ant_ctx *ctx, uint16_t addr);
+void ant_poll_remove(ant_ctx *ctx, uint16_t addr);
+const ant_poll_slave *ant_poll_table(ant_ctx *ctx, uint8_t *count);
+#endif
+#if ANT_RX_BUFFERS > 1
+uint8_t ant_frame_hold(ant_ctx *ctx, const uint8_t *buf);
+void ant_frame_release(ant_ctx *ctx, const uint8_t *buf);
+#endif
+#if ANT_DEFERRED_QUEUE_SIZE > 0
+uint8_t ant_run_deferred(ant_ctx *ctx, uint8_t max);
+uint16_t ant_deferred_dropped(ant_ctx *ctx);
+#endif
+
+#endif
@@ -0,0 +1,72 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#include "ant.h"
+#include "ant_port.h"
+
+// Context bound to each USART, for the RX interrupt handlers
+static ant_ctx *usart_ctx[ANT_PORT_DEVICES];
+
+// USART RX interrupt handlers. UDRn is always read to clear the interrupt,
+// even when no context has been bound to the USART yet.
+#if defined(USART_RX_vect)
+ISR(USART_RX_vect) {
+  ANT_TRACE_ISR_ENTER();
+  ant_rx_byte(usart_ctx[0], UDR0);
+  ANT_TRACE_ISR_EXIT(ANT_TRACE_RX_ISR);
+}
+#else
+ISR(USART0_RX_vect) {
+  ANT_TRACE_ISR_ENTER();
+  ant_rx_byte(usart_ctx[0], UDR0);
+  ANT_TRACE_ISR_EXIT(ANT_TRACE_RX_ISR);
+}
+#endif
+
+#if defined(USART1_RX_vect)
+ISR(USART1_RX_vect) {
+  ANT_TRACE_ISR_ENTER();
+  ant_rx_byte(usart_ctx[1], UDR1);
+  ANT_TRACE_ISR_EXIT(ANT_TRACE_RX_ISR);
+}
+#endif
+
+void ant_port_attach(ant_ctx *ctx)
+{
+  // The pointer is two bytes wide, don't let the ISR see half of it
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    usart_ctx[ctx->config.usart] = ctx;
+  }
+}
+
+void ant_port_write(uint8_t dev, const uint8_t *buf, uint8_t len)
+{
+  uint8_t i;
+
+  for (i = 0; i < len; i++) {
+#if defined(UDR1)
+    if (dev == 1) {
+      while ( !( UCSR1A & (1<<UDRE1)) );
+      UDR1 = buf[i];
+      continue;
+    }
+#endif
+    while ( !( UCSR0A & (1<<UDRE0)) );
+    UDR0 = buf[i];
+  }
+}
+
+//General short delays
+void ant_port_delay_ms(uint16_t x) {
+  uint8_t y, z;
+
+  for ( ; x > 0 ; x--) {
+    for ( y = 0 ; y < 90 ; y++) {
+      for ( z = 0 ; z < 6 ; z++) {
+        asm volatile ("nop");
+      }
+    }
+  }
+}
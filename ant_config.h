@@ -0,0 +1,192 @@
+/* Compile-time configuration for avr_ant.
+
+   Every buffer the driver, the debug UART and the optional subsystems
+   reserve is sized here, and unused subsystems can be compiled out, so a
+   small node only pays for what it uses. Everything can be overridden from
+   the compiler command line (e.g. -DANT_RX_RING_SIZE=32). Consistency is
+   checked with static assertions in ant.c. */
+
+#ifndef ANT_CONFIG_H
+#define ANT_CONFIG_H
+
+// Size of the USART RX ring buffer in bytes, per radio. One slot is always
+// kept free and the index type is 8 bits wide, so the range is
+// MESG_MAX_SIZE + 1 to 255. At 4800 baud the default holds ~130ms of
+// traffic; the ring_high_water statistic shows how much is really used.
+#if !defined(ANT_RX_RING_SIZE)
+  #define ANT_RX_RING_SIZE 64
+#endif
+
+// Largest message the parser assembles, per radio. Must be at least
+// MAXMSG (14), which fits every message with an 8-byte payload, or 18 in
+// scan mode for the extended messages carrying the sender's channel ID.
+// With ANT_RX_META RSSI and timestamp add 5 more.
+#if !defined(ANT_RX_MSG_SIZE)
+  #if defined(ANT_SCAN) && ANT_SCAN
+    #define ANT_RX_MSG_SIZE_BASE 18
+  #else
+    #define ANT_RX_MSG_SIZE_BASE 14
+  #endif
+  #if defined(ANT_RX_META) && ANT_RX_META
+    #define ANT_RX_MSG_SIZE (ANT_RX_MSG_SIZE_BASE + 5)
+  #else
+    #define ANT_RX_MSG_SIZE ANT_RX_MSG_SIZE_BASE
+  #endif
+#endif
+
+// Receive buffers per radio. With more than one, the application can keep
+// a received message with ant_frame_hold() instead of copying it, while
+// the parser carries on in another buffer. Each costs ANT_RX_MSG_SIZE
+// bytes of RAM.
+#if !defined(ANT_RX_BUFFERS)
+  #define ANT_RX_BUFFERS 1
+#endif
+
+// Driver debug output through printf. The format strings are kept in
+// flash. Set to 0 to compile all of it out.
+#if !defined(ANT_DEBUG)
+  #define ANT_DEBUG 1
+#endif
+
+// Debug UART (softuart). The example only transmits, so the receiver and
+// its input buffer are compiled out unless enabled here.
+#if !defined(SOFTUART_RX_ENABLED)
+  #define SOFTUART_RX_ENABLED 0
+#endif
+#if !defined(SOFTUART_IN_BUF_SIZE)
+  #define SOFTUART_IN_BUF_SIZE 32
+#endif
+
+// Master publish slot (ant_publish): the driver sends the latest value to
+// the module on every EVENT_TX. Set to 1 to compile it in.
+#if !defined(ANT_PUBLISH)
+  #define ANT_PUBLISH 0
+#endif
+
+// Reliable delivery (ant_send_reliable): number of acknowledged messages
+// that can be queued, how often a failed one is retried, and the most TX
+// slots skipped between retries. A queue size of 0 compiles it out; a
+// master that uses it would typically set 4.
+#if !defined(ANT_RELIABLE_QUEUE_SIZE)
+  #define ANT_RELIABLE_QUEUE_SIZE 0
+#endif
+#if !defined(ANT_RELIABLE_MAX_RETRIES)
+  #define ANT_RELIABLE_MAX_RETRIES 3
+#endif
+#if !defined(ANT_RELIABLE_MAX_BACKOFF)
+  #define ANT_RELIABLE_MAX_BACKOFF 8
+#endif
+
+// Shared channel polling (ant_poll_add): number of slave addresses a
+// master can poll, how many polls in a row a slave may miss before it is
+// considered dead, and the most turns a dead slave is passed over before
+// it is tried again. 0 slaves compiles it out.
+#if !defined(ANT_POLL_SLAVES)
+  #define ANT_POLL_SLAVES 0
+#endif
+#if !defined(ANT_POLL_DEAD_MISSES)
+  #define ANT_POLL_DEAD_MISSES 3
+#endif
+#if !defined(ANT_POLL_MAX_SKIP)
+  #define ANT_POLL_MAX_SKIP 16
+#endif
+
+// Adaptive channel period (ant_configuration.period_min/max): a master
+// halves its period when the payload changes on most messages or
+// acknowledged messages queue up, and doubles it when it hasn't changed at
+// all, judged over ANT_PERIOD_WINDOW messages. A slave only follows: it
+// doubles its period when at least 3/8 of its slots come up empty because
+// the master slowed down, and tries halving it again after windows
+// without a fail, waiting up to ANT_PERIOD_MAX_HOLD windows (a power of
+// two) between tries that don't work out. Set ANT_ADAPTIVE_PERIOD to 1 to
+// compile it in.
+#if !defined(ANT_ADAPTIVE_PERIOD)
+  #define ANT_ADAPTIVE_PERIOD 0
+#endif
+#if !defined(ANT_PERIOD_WINDOW)
+  #define ANT_PERIOD_WINDOW 16
+#endif
+#if !defined(ANT_PERIOD_MAX_HOLD)
+  #define ANT_PERIOD_MAX_HOLD 16
+#endif
+
+// Slave search timeouts, in 2.5s units. After losing the master the module
+// first searches at low priority (cheaper, and doesn't block other
+// channels) for ANT_LP_SEARCH_TIMEOUT, then at high priority for
+// ANT_SEARCH_TIMEOUT before closing the channel, which the driver then
+// simply reopens. The defaults spend 10s of each cycle in the cheap search
+// and 5s in the high priority one. 0 skips that part of the search, 255
+// never gives up on it.
+#if !defined(ANT_LP_SEARCH_TIMEOUT)
+  #define ANT_LP_SEARCH_TIMEOUT 4
+#endif
+#if !defined(ANT_SEARCH_TIMEOUT)
+  #define ANT_SEARCH_TIMEOUT 2
+#endif
+
+// Continuous RX scan mode (ant_configuration.scan): a slave receives from
+// every transmitter in range and keeps the latest message of up to
+// ANT_SCAN_DEVICES of them. Set ANT_SCAN to 1 to compile it in.
+#if !defined(ANT_SCAN)
+  #define ANT_SCAN 0
+#endif
+#if !defined(ANT_SCAN_DEVICES)
+  #define ANT_SCAN_DEVICES 8
+#endif
+
+// Receive metadata: the module appends the RSSI and its RX timestamp to
+// every broadcast it receives, see ant_get_rx_meta(). Set to 1 to compile
+// it in.
+#if !defined(ANT_RX_META)
+  #define ANT_RX_META 0
+#endif
+
+// Deferred callbacks: instead of calling the application in the middle of
+// parsing, dispatch queues up to this many callbacks and ant_run_deferred()
+// runs them from the main loop. 0 calls them straight away. The driver's
+// own transmissions (acknowledged messages, polls, the published value)
+// wait until ant_run_deferred() has run the callbacks queued before their
+// TX slot, so they still win over anything those send. Deferred callbacks
+// aren't timed by ANT_TRACE.
+#if !defined(ANT_DEFERRED_QUEUE_SIZE)
+  #define ANT_DEFERRED_QUEUE_SIZE 0
+#endif
+
+// Latency instrumentation, see ant_trace.h. Off by default; when on it
+// takes over Timer1 and costs a few hundred bytes of RAM.
+#if !defined(ANT_TRACE)
+  #define ANT_TRACE 0
+#endif
+#if !defined(ANT_TRACE_PRESCALE)
+  #define ANT_TRACE_PRESCALE 8
+#endif
+#if !defined(ANT_TRACE_BUCKETS)
+  #define ANT_TRACE_BUCKETS 12
+#endif
+// Sync timestamps kept per radio (power of two). Frames arriving further
+// behind than this go unmeasured.
+#if !defined(ANT_TRACE_STAMPS)
+  #define ANT_TRACE_STAMPS 4
+#endif
+
+// Callbacks can be bound at compile time instead of through the function
+// pointers in ant_configuration. dispatch_msg() then makes a direct call
+// (which the compiler may inline) and the pointer in the struct is ignored.
+// Define them to the handler's name, e.g. in the Makefile:
+//   -DANT_CALLBACK_BROADCAST_RECV=callback_broadcast_recv
+//
+//   ANT_CALLBACK_EVENT_TX         void name(ant_ctx *ctx)
+//   ANT_CALLBACK_BROADCAST_RECV   void name(ant_ctx *ctx, uint8_t *buf,
+//                                           uint8_t len)
+//   ANT_CALLBACK_DELIVERY         void name(ant_ctx *ctx, uint8_t id,
+//                                           uint8_t status)
+//   ANT_CALLBACK_SCAN_RECV        void name(ant_ctx *ctx,
+//                                           ant_scan_device *dev)
+//   ANT_CALLBACK_FRAME            void name(ant_ctx *ctx, uint8_t dir,
+//                                           const uint8_t *buf, uint8_t len)
+
+// Compile-time check, usable at file scope on any C compiler
+#define ANT_STATIC_ASSERT(cond, name) \
+  typedef char ant_static_assert_##name[(cond) ? 1 : -1]
+
+#endif
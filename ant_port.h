@@ -0,0 +1,55 @@
+/* Port layer of the ANT driver.
+
+   ant.c is plain C and only reaches the hardware through what is declared
+   here. ant_avr.c implements it on the AVR USARTs, host/ant_host.c on
+   Linux serial devices. A port device is whatever ant_configuration.usart
+   numbers: a USART on the AVR, an opened tty on Linux. */
+
+#ifndef ANT_PORT_H
+#define ANT_PORT_H
+
+#include <stdint.h>
+
+#include "ant.h"
+
+#if defined(__AVR__)
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#if defined(UDR1)
+  #define ANT_PORT_DEVICES 2
+#else
+  #define ANT_PORT_DEVICES 1
+#endif
+
+// Debug output, format strings stay in flash
+#define ANT_PORT_LOG(fmt, ...) printf_P(PSTR(fmt), ##__VA_ARGS__)
+
+// Guards data shared with the RX interrupt
+#define ANT_ATOMIC ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+
+#else
+
+#if !defined(ANT_PORT_DEVICES)
+  #define ANT_PORT_DEVICES 16
+#endif
+
+#define ANT_PORT_LOG(fmt, ...) printf(fmt, ##__VA_ARGS__)
+
+// Received bytes are fed to the parser by the thread that runs it, there's
+// nothing to guard
+#define ANT_ATOMIC
+
+#endif
+
+// Routes bytes received on device ctx->config.usart to ctx
+void ant_port_attach(ant_ctx *ctx);
+
+// Sends len bytes to the module on a device, returns once they're queued
+void ant_port_write(uint8_t dev, const uint8_t *buf, uint8_t len);
+
+void ant_port_delay_ms(uint16_t ms);
+
+#endif
@@ -0,0 +1,90 @@
+#include <avr/io.h>
+#include <util/atomic.h>
+#include <string.h>
+
+#include "ant_trace.h"
+
+#if ANT_TRACE
+
+#if (ANT_TRACE_PRESCALE == 1)
+  #define TRACE_CS  (1 << CS10)
+#elif (ANT_TRACE_PRESCALE == 8)
+  #define TRACE_CS  (1 << CS11)
+#elif (ANT_TRACE_PRESCALE == 64)
+  #define TRACE_CS  ((1 << CS11) | (1 << CS10))
+#else
+  #error "ANT_TRACE_PRESCALE must be 1, 8 or 64"
+#endif
+
+static ant_trace_hist hist[ANT_TRACE_STAGES];
+
+void ant_trace_init(void)
+{
+  ant_trace_reset();
+
+  // Timer1 free running, normal mode, no interrupts
+  TCCR1A = 0;
+  TCCR1B = TRACE_CS;
+}
+
+void ant_trace_reset(void)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    memset(hist, 0, sizeof(hist));
+  }
+}
+
+// The 16-bit read goes through the shared TEMP register, so an ISR reading
+// TCNT1 between the two halves would corrupt it
+uint16_t ant_trace_now(void)
+{
+  uint16_t t;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    t = TCNT1;
+  }
+
+  return t;
+}
+
+// Called from both ISRs and the main loop, but never for the same stage
+// from both, so no locking is needed here
+void ant_trace_record(uint8_t stage, uint16_t ticks)
+{
+  ant_trace_hist *h = &hist[stage];
+  uint16_t v = ticks;
+  uint8_t bucket = 0;
+
+  while (v > 1 && bucket < ANT_TRACE_BUCKETS - 1) {
+    v >>= 1;
+    bucket++;
+  }
+  if (h->buckets[bucket] < 0xffff)
+    h->buckets[bucket]++;
+
+  if (h->count == 0 || ticks < h->min)
+    h->min = ticks;
+  if (ticks > h->max)
+    h->max = ticks;
+
+  // Halve both when the count would wrap, which keeps the average right
+  // and weights it towards recent samples
+  if (h->count == 0xffff) {
+    h->count >>= 1;
+    h->sum >>= 1;
+  }
+  h->count++;
+  h->sum += ticks;
+}
+
+void ant_trace_get(uint8_t stage, ant_trace_hist *out)
+{
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    *out = hist[stage];
+  }
+}
+
+#endif
@@ -0,0 +1,55 @@
+/* Optional latency instrumentation for avr_ant (ANT_TRACE in ant_config.h).
+
+   Timer1 runs free at F_CPU / ANT_TRACE_PRESCALE and timestamps each stage
+   of a received message: the sync byte arriving in the USART ISR, the
+   checksum completing in ant_handle_msg(), and entry and exit of the
+   broadcast callback. Time spent in the USART and softuart ISRs is
+   recorded too. Each stage keeps min/avg/max and a log2 histogram.
+
+   Intervals are 16 bits of timer ticks, so anything longer than one timer
+   wrap (65ms at the default 1us tick) aliases. */
+
+#ifndef ANT_TRACE_H
+#define ANT_TRACE_H
+
+#include <stdint.h>
+
+#include "ant_config.h"
+
+// Measured stages
+#define ANT_TRACE_RX_TO_PARSED        0  // Sync byte received -> checksum ok
+#define ANT_TRACE_PARSED_TO_CALLBACK  1  // Checksum ok -> callback entered
+#define ANT_TRACE_CALLBACK            2  // Time spent in the callback
+#define ANT_TRACE_RX_ISR              3  // Time spent in the USART RX ISR
+#define ANT_TRACE_SOFTUART_ISR        4  // Time spent in the softuart ISR
+#define ANT_TRACE_STAGES              5
+
+typedef struct ant_trace_hist
+{
+  uint16_t min;
+  uint16_t max;
+  uint32_t sum;                         // avg = sum / count
+  uint16_t count;
+  uint16_t buckets[ANT_TRACE_BUCKETS];  // [i] counts 2^i..2^(i+1)-1 ticks
+} ant_trace_hist;
+
+#if ANT_TRACE
+
+void ant_trace_init(void);
+void ant_trace_reset(void);
+uint16_t ant_trace_now(void);
+void ant_trace_record(uint8_t stage, uint16_t ticks);
+void ant_trace_get(uint8_t stage, ant_trace_hist *hist);
+
+// Brackets an ISR body to record the time spent in it
+#define ANT_TRACE_ISR_ENTER()      uint16_t ant_trace_t0 = ant_trace_now()
+#define ANT_TRACE_ISR_EXIT(stage)  ant_trace_record(stage, ant_trace_now() - ant_trace_t0)
+
+#else
+
+#define ANT_TRACE_ISR_ENTER()
+#define ANT_TRACE_ISR_EXIT(stage)
+
+#endif
+
+#endif
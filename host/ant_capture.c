@@ -0,0 +1,188 @@
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "ant.h"
+#include "ant_capture.h"
+
+#define TIME_BASE 0xFF       // Flags byte of a time base record
+
+static const uint8_t header[8] = { 'A', 'N', 'T', 'C', 'A', 'P',
+                                   ANT_CAPTURE_VERSION, 0 };
+
+static uint8_t put_varint(uint8_t *p, uint64_t v)
+{
+  uint8_t n = 0;
+
+  while (v >= 0x80)
+  {
+    p[n++] = (uint8_t)v | 0x80;
+    v >>= 7;
+  }
+  p[n++] = (uint8_t)v;
+
+  return n;
+}
+
+static int get_varint(FILE *f, uint64_t *v)
+{
+  uint8_t shift;
+  int c;
+
+  *v = 0;
+  for (shift = 0; shift < 64; shift += 7)
+  {
+    c = getc(f);
+    if (c == EOF)
+      return (shift == 0) ? 0 : -1;
+
+    *v |= (uint64_t)(c & 0x7F) << shift;
+    if (!(c & 0x80))
+      return 1;
+  }
+
+  return -1;
+}
+
+uint64_t ant_capture_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int ant_capture_append(ant_capture *cap, const char *path)
+{
+  uint8_t buf[12];
+  uint8_t n = 0;
+
+  cap->file = fopen(path, "ab");
+  if (!cap->file)
+    return -1;
+
+  if (ftell(cap->file) == 0 &&
+      fwrite(header, sizeof(header), 1, cap->file) != 1)
+    goto fail;
+
+  cap->last_us = ant_capture_now();
+  buf[n++] = 0;
+  buf[n++] = TIME_BASE;
+  n += put_varint(buf + n, cap->last_us);
+  if (fwrite(buf, n, 1, cap->file) != 1)
+    goto fail;
+
+  return 0;
+
+fail:
+  fclose(cap->file);
+  cap->file = NULL;
+  return -1;
+}
+
+int ant_capture_open(ant_capture *cap, const char *path)
+{
+  uint8_t buf[sizeof(header)];
+
+  cap->file = fopen(path, "rb");
+  if (!cap->file)
+    return -1;
+
+  if (fread(buf, sizeof(buf), 1, cap->file) != 1 ||
+      memcmp(buf, header, sizeof(header)) != 0)
+  {
+    fclose(cap->file);
+    cap->file = NULL;
+    errno = EINVAL;
+    return -1;
+  }
+
+  cap->last_us = 0;
+  return 0;
+}
+
+int ant_capture_write(ant_capture *cap, uint64_t time_us, uint8_t dev,
+                      uint8_t dir, const uint8_t *frame)
+{
+  uint8_t buf[10 + 1 + MESG_EXT_MAX_SIZE];
+  uint8_t n, size = frame[1];
+  int rc = 0;
+
+  if (dev > ANT_CAPTURE_MAX_DEV || size > MESG_EXT_MAX_DATA_SIZE)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  // The stream lock also keeps last_us consistent between threads
+  flockfile(cap->file);
+
+  if (time_us < cap->last_us)  // Clock stepped back, keep deltas positive
+    time_us = cap->last_us;
+  n = put_varint(buf, time_us - cap->last_us);
+  cap->last_us = time_us;
+
+  buf[n++] = (dir == ANT_FRAME_TX ? 0x80 : 0) | dev;
+  memcpy(buf + n, frame + 1, size + 2);  // Length, id, data
+  n += size + 2;
+
+  if (fwrite_unlocked(buf, n, 1, cap->file) != 1)
+    rc = -1;
+
+  funlockfile(cap->file);
+  return rc;
+}
+
+int ant_capture_read(ant_capture *cap, ant_capture_record *rec)
+{
+  uint64_t v;
+  uint8_t i, chk;
+  int c, rc;
+
+  while (1)
+  {
+    rc = get_varint(cap->file, &v);
+    if (rc <= 0)
+      return rc;
+
+    c = getc(cap->file);
+    if (c == EOF)
+      return -1;
+    if (c != TIME_BASE)
+      break;
+
+    // Time base, the next record is relative to it
+    if (get_varint(cap->file, &v) <= 0)
+      return -1;
+    cap->last_us = v;
+  }
+
+  cap->last_us += v;
+  rec->time_us = cap->last_us;
+  rec->dir = (c & 0x80) ? ANT_FRAME_TX : ANT_FRAME_RX;
+  rec->dev = c & 0x7F;
+
+  c = getc(cap->file);
+  if (c == EOF || c > MESG_EXT_MAX_DATA_SIZE)
+    return -1;
+
+  rec->frame[0] = MESG_TX_SYNC;
+  rec->frame[1] = c;
+  if (fread(rec->frame + 2, c + 1, 1, cap->file) != 1)
+    return -1;
+
+  rec->len = c + MESG_FRAME_SIZE;
+  chk = 0;
+  for (i = 0; i < rec->len - 1; i++)
+    chk ^= rec->frame[i];
+  rec->frame[rec->len - 1] = chk;
+
+  return 1;
+}
+
+void ant_capture_close(ant_capture *cap)
+{
+  if (cap->file)
+    fclose(cap->file);
+  cap->file = NULL;
+}
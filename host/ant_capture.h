@@ -0,0 +1,66 @@
+/* Compact binary capture of ANT traffic, for recording what a gateway saw
+   and replaying it later (capreplay).
+
+   A capture is an 8-byte header ("ANTCAP", version, 0) followed by
+   records, with no padding anywhere:
+
+     varint   microseconds since the previous record (LEB128)
+     uint8    bit 7: direction (ANT_FRAME_TX), bits 0-6: device
+     uint8    message length byte
+     uint8    message id
+     n bytes  message data
+
+   The sync byte and checksum aren't stored, they're rebuilt on reading.
+   A flags byte of 0xFF marks a time base record instead: it is followed
+   by a second varint, the absolute time in microseconds, and no message.
+   Writers start with one, so captures can be appended to without reading
+   them first. Messages of up to MESG_EXT_MAX_DATA_SIZE bytes are kept,
+   whichever ANT_RX_META setting wrote or reads the capture. */
+
+#ifndef ANT_CAPTURE_H
+#define ANT_CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "ant.h"
+
+#define ANT_CAPTURE_VERSION   1
+#define ANT_CAPTURE_MAX_DEV   126  // Devices that can be recorded
+
+typedef struct ant_capture
+{
+  FILE *file;
+  uint64_t last_us;          // Time of the previous record
+} ant_capture;
+
+typedef struct ant_capture_record
+{
+  uint64_t time_us;
+  uint8_t dev;
+  uint8_t dir;               // ANT_FRAME_RX or ANT_FRAME_TX
+  uint8_t len;               // Bytes in frame, sync to checksum
+  uint8_t frame[MESG_EXT_MAX_SIZE];
+} ant_capture_record;
+
+// Open a capture for appending (created if needed) or for reading.
+// Return 0, or -1 with errno set (EINVAL for a file that isn't a capture).
+int ant_capture_append(ant_capture *cap, const char *path);
+int ant_capture_open(ant_capture *cap, const char *path);
+
+// Adds one message (raw bytes from sync to checksum, as handed to the
+// frame callback). Safe to call from several threads on one capture.
+// Returns 0, or -1 with errno set.
+int ant_capture_write(ant_capture *cap, uint64_t time_us, uint8_t dev,
+                      uint8_t dir, const uint8_t *frame);
+
+// Reads the next message. Returns 1, 0 at the end of the capture, or -1
+// if it is corrupt or cut short.
+int ant_capture_read(ant_capture *cap, ant_capture_record *rec);
+
+void ant_capture_close(ant_capture *cap);
+
+// Microseconds on the realtime clock, for ant_capture_write()
+uint64_t ant_capture_now(void);
+
+#endif
@@ -0,0 +1,238 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "ant.h"
+#include "ant_port.h"
+#include "ant_host.h"
+
+// Bytes read from a device per read() call
+#define HOST_READ_SIZE 4096
+
+// Longest a write waits for a device to take more bytes before the device
+// is given up on, so one stalled adapter can't hold up the others
+#define HOST_WRITE_TIMEOUT_MS 100
+
+typedef struct host_device
+{
+  int fd;                    // -1 when closed
+  ant_ctx *ctx;              // Bound by ant_init(), may still be NULL
+} host_device;
+
+static host_device devices[ANT_PORT_DEVICES] = {
+  [0 ... ANT_PORT_DEVICES - 1] = { -1, NULL }
+};
+static int epoll_fd = -1;
+
+static int host_init(void)
+{
+  if (epoll_fd >= 0)
+    return 0;
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  return (epoll_fd < 0) ? -1 : 0;
+}
+
+static speed_t baud_to_speed(uint32_t baud)
+{
+  switch (baud)
+  {
+    case 4800:   return B4800;
+    case 9600:   return B9600;
+    case 19200:  return B19200;
+    case 38400:  return B38400;
+    case 57600:  return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    default:     return 0;
+  }
+}
+
+int ant_host_open(uint8_t dev, const char *path, uint32_t baud)
+{
+  struct epoll_event ev;
+  struct termios tio;
+  speed_t speed = baud_to_speed(baud);
+  int fd;
+
+  if (host_init() < 0)
+    return -1;
+
+  if (dev >= ANT_PORT_DEVICES || devices[dev].fd >= 0 || speed == 0)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  // Raw bytes, no echo or line editing, reads never wait
+  if (tcgetattr(fd, &tio) < 0)
+    goto fail;
+  cfmakeraw(&tio);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 0;
+  cfsetispeed(&tio, speed);
+  cfsetospeed(&tio, speed);
+  if (tcsetattr(fd, TCSANOW, &tio) < 0)
+    goto fail;
+  tcflush(fd, TCIOFLUSH);
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u32 = dev;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    goto fail;
+
+  devices[dev].fd = fd;
+  return 0;
+
+fail:
+  close(fd);
+  return -1;
+}
+
+void ant_host_close(uint8_t dev)
+{
+  if (dev >= ANT_PORT_DEVICES || devices[dev].fd < 0)
+    return;
+
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, devices[dev].fd, NULL);
+  close(devices[dev].fd);
+  devices[dev].fd = -1;
+}
+
+// Drains a readable device into its parser. With VMIN and VTIME at 0 a
+// read of 0 only means nothing is waiting; a hangup shows up as EIO here
+// or as POLLHUP/POLLERR, which the callers check after draining.
+static void host_read(uint8_t dev)
+{
+  uint8_t buf[HOST_READ_SIZE];
+  host_device *d = &devices[dev];
+  ssize_t n;
+
+  do {
+    n = read(d->fd, buf, sizeof(buf));
+    if (n < 0)
+    {
+      if (errno == EAGAIN || errno == EINTR)
+        return;
+      ant_host_close(dev);
+      return;
+    }
+
+    // Like the AVR ISR, data for an unbound device is read and dropped
+    if (d->ctx && n > 0)
+      ant_feed(d->ctx, buf, n);
+  } while (n == sizeof(buf));
+}
+
+int ant_host_poll(int timeout_ms)
+{
+  struct epoll_event events[ANT_PORT_DEVICES];
+  int i, n;
+
+  if (host_init() < 0)
+    return -1;
+
+  n = epoll_wait(epoll_fd, events, ANT_PORT_DEVICES, timeout_ms);
+  if (n < 0)
+    return (errno == EINTR) ? 0 : -1;
+
+  for (i = 0; i < n; i++)
+  {
+    // A device closed by a callback earlier in this batch
+    if (devices[events[i].data.u32].fd < 0)
+      continue;
+
+    // Whatever arrived before a hangup is still delivered
+    if (events[i].events & EPOLLIN)
+      host_read(events[i].data.u32);
+    if (events[i].events & (EPOLLHUP | EPOLLERR))
+      ant_host_close(events[i].data.u32);
+  }
+
+  return n;
+}
+
+int ant_host_read(uint8_t dev, int timeout_ms)
+{
+  struct pollfd pfd;
+  int n;
+
+  if (dev >= ANT_PORT_DEVICES || devices[dev].fd < 0)
+    return -1;
+
+  pfd.fd = devices[dev].fd;
+  pfd.events = POLLIN;
+
+  n = poll(&pfd, 1, timeout_ms);
+  if (n < 0)
+    return (errno == EINTR) ? 0 : -1;
+  if (n == 0)
+    return 0;
+
+  if (pfd.revents & POLLIN)
+    host_read(dev);
+  if (pfd.revents & (POLLHUP | POLLERR | POLLNVAL))
+    ant_host_close(dev);
+
+  return (devices[dev].fd < 0) ? -1 : 1;
+}
+
+void ant_port_attach(ant_ctx *ctx)
+{
+  devices[ctx->config.usart].ctx = ctx;
+}
+
+void ant_port_write(uint8_t dev, const uint8_t *buf, uint8_t len)
+{
+  struct pollfd pfd;
+  ssize_t n;
+
+  if (devices[dev].fd < 0)
+    return;
+
+  pfd.fd = devices[dev].fd;
+  pfd.events = POLLOUT;
+
+  while (len > 0)
+  {
+    n = write(pfd.fd, buf, len);
+    if (n > 0)
+    {
+      buf += n;
+      len -= n;
+    }
+    else if (n < 0 && errno == EAGAIN)
+    {
+      if (poll(&pfd, 1, HOST_WRITE_TIMEOUT_MS) == 0)
+      {
+        ant_host_close(dev);
+        return;
+      }
+    }
+    else if (n < 0 && errno != EINTR)
+    {
+      return;  // Dropped; the device shows up as hung up on the next poll
+    }
+  }
+}
+
+void ant_port_delay_ms(uint16_t ms)
+{
+  struct timespec ts;
+
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (long)(ms % 1000) * 1000000;
+  while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+    ;
+}
@@ -0,0 +1,37 @@
+/* Linux port of the ANT driver.
+
+   Each serial device (an ANT USB stick, or a pty for testing) is a port
+   device, numbered by ant_configuration.usart like the USARTs on the AVR.
+   Devices are opened raw and non-blocking and watched by a single epoll
+   instance; ant_host_poll() reads whatever has arrived in large chunks and
+   feeds it straight into the parser of the radio bound to each device.
+
+   Typical use: ant_host_open() each device, ant_init() a context for it,
+   then call ant_host_poll() in a loop. Everything runs on the calling
+   thread, callbacks included. Alternatively each device can be serviced
+   by a thread of its own with ant_host_read(), see ant_pipeline.h. */
+
+#ifndef ANT_HOST_H
+#define ANT_HOST_H
+
+#include <stdint.h>
+
+#include "ant.h"
+
+// Opens path at the given baud rate as device dev. Returns 0, or -1 with
+// errno set.
+int ant_host_open(uint8_t dev, const char *path, uint32_t baud);
+
+void ant_host_close(uint8_t dev);
+
+// Waits up to timeout_ms (-1 forever) for data on any open device and
+// dispatches every complete message received. Devices that fail or hang
+// up are closed. Returns the number of devices serviced, 0 on timeout,
+// or -1 with errno set.
+int ant_host_poll(int timeout_ms);
+
+// Like ant_host_poll() for a single device, without epoll. Returns 1 if
+// data was read, 0 on timeout, or -1 once the device is closed.
+int ant_host_read(uint8_t dev, int timeout_ms);
+
+#endif
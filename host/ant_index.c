@@ -0,0 +1,158 @@
+#include <string.h>
+
+#include "ant.h"
+#include "ant_index.h"
+
+#if ANT_INDEX_SIMD && (defined(__x86_64__) || defined(__i386__))
+  #include <immintrin.h>
+  #define INDEX_X86 1
+#else
+  #define INDEX_X86 0
+#endif
+
+// Bytes xor_bytes() loads at once, enough for the largest message
+#define XOR_WINDOW 24
+ANT_STATIC_ASSERT(MESG_EXT_MAX_SIZE <= XOR_WINDOW,
+                  xor_window_holds_message);
+
+typedef size_t (*next_sync_fn)(const uint8_t *buf, size_t len, size_t i);
+
+// MESG_TX_SYNC (0xA4) and MESG_RX_SYNC (0xA5) only differ in bit 0
+static inline int is_sync(uint8_t byte)
+{
+  return (byte & 0xFE) == MESG_TX_SYNC;
+}
+
+// Offset of the first sync byte at or after i, or len
+static size_t next_sync_scalar(const uint8_t *buf, size_t len, size_t i)
+{
+  for ( ; i < len; i++)
+  {
+    if (is_sync(buf[i]))
+      return i;
+  }
+  return len;
+}
+
+#if INDEX_X86
+static size_t next_sync_sse2(const uint8_t *buf, size_t len, size_t i)
+{
+  const __m128i bits = _mm_set1_epi8((char)0xFE);
+  const __m128i sync = _mm_set1_epi8((char)MESG_TX_SYNC);
+  __m128i v;
+  unsigned mask;
+
+  for ( ; i + 16 <= len; i += 16)
+  {
+    v = _mm_loadu_si128((const __m128i *)(buf + i));
+    mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(v, bits), sync));
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  return next_sync_scalar(buf, len, i);
+}
+
+__attribute__((target("avx2")))
+static size_t next_sync_avx2(const uint8_t *buf, size_t len, size_t i)
+{
+  const __m256i bits = _mm256_set1_epi8((char)0xFE);
+  const __m256i sync = _mm256_set1_epi8((char)MESG_TX_SYNC);
+  __m256i v;
+  unsigned mask;
+
+  for ( ; i + 32 <= len; i += 32)
+  {
+    v = _mm256_loadu_si256((const __m256i *)(buf + i));
+    mask = _mm256_movemask_epi8(
+             _mm256_cmpeq_epi8(_mm256_and_si256(v, bits), sync));
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  return next_sync_sse2(buf, len, i);
+}
+#endif
+
+// XOR of n (at most XOR_WINDOW) bytes. The checksum is the XOR of everything
+// before it, so a good message XORs to 0 including its checksum.
+static inline uint8_t xor_bytes(const uint8_t *p, uint8_t n, int whole_words)
+{
+  uint64_t w[XOR_WINDOW / 8], x = 0;
+  uint8_t i, k;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  if (whole_words)
+  {
+    // Three unaligned words, with the bytes past n masked off
+    memcpy(w, p, sizeof(w));
+    for (k = 0; n > 0; k++, n -= i)
+    {
+      i = (n < 8) ? n : 8;
+      x ^= (i == 8) ? w[k] : (w[k] & ((1ULL << (8 * i)) - 1));
+    }
+    x ^= x >> 32;
+    x ^= x >> 16;
+    x ^= x >> 8;
+    return (uint8_t)x;
+  }
+#endif
+
+  for (i = 0; i < n; i++)
+    x ^= p[i];
+  return (uint8_t)x;
+}
+
+// Size of the message starting with the sync byte at buf[i], 0 if there
+// isn't one, or -1 if it would run past len
+static inline int frame_at(const uint8_t *buf, size_t len, size_t i)
+{
+  uint8_t size;
+
+  if (i + 1 >= len)
+    return -1;
+  if (buf[i + 1] > MESG_EXT_MAX_DATA_SIZE)
+    return 0;
+
+  size = buf[i + 1] + MESG_FRAME_SIZE;
+  if (i + size > len)
+    return -1;
+
+  return xor_bytes(buf + i, size, i + XOR_WINDOW <= len) == 0 ? size : 0;
+}
+
+size_t ant_index_frames(const uint8_t *buf, size_t len, size_t *offsets,
+                        size_t max, size_t *resume)
+{
+  next_sync_fn next_sync = next_sync_scalar;
+  size_t i = 0, found = 0, tail = len;
+  int size;
+
+#if INDEX_X86
+  next_sync = __builtin_cpu_supports("avx2") ? next_sync_avx2 : next_sync_sse2;
+#endif
+
+  while (found < max)
+  {
+    i = next_sync(buf, len, i);
+    if (i == len)
+      break;
+
+    size = frame_at(buf, len, i);
+    if (size <= 0)
+    {
+      // Cut off: may complete with more data, unless a complete message
+      // follows it, which makes it a false sync
+      if (size < 0 && tail == len)
+        tail = i;
+      i++;
+      continue;
+    }
+
+    offsets[found++] = i;
+    i += size;
+    tail = len;
+  }
+
+  if (resume)
+    *resume = (tail < len) ? tail : i;
+  return found;
+}
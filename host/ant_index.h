@@ -0,0 +1,33 @@
+/* Bulk message indexer for captures of raw ANT serial traffic.
+
+   Finds every well-formed message in a buffer (typically an mmap'd
+   capture) the way the driver's parser would: a sync byte (MESG_TX_SYNC or
+   MESG_RX_SYNC, so both directions of a capture are found), a length no
+   larger than MESG_EXT_MAX_DATA_SIZE (the longest a build with ANT_RX_META
+   takes) and a correct checksum. After a good message the search carries
+   on behind it, after a bad one at the next byte. Sync candidates are
+   located 16 or 32 bytes at a time with SSE2 or AVX2 (picked at run time)
+   and each checksum is folded a word at a time, with a scalar fallback
+   elsewhere. */
+
+#ifndef ANT_INDEX_H
+#define ANT_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Set to 0 to force the scalar code
+#if !defined(ANT_INDEX_SIMD)
+  #define ANT_INDEX_SIMD 1
+#endif
+
+// Stores the offsets of up to max messages found in buf[0..len) and
+// returns how many were stored. If resume isn't NULL it is set to where
+// the search stopped: at len, after the last message when offsets filled
+// up, or at the first sync whose message is cut off by the end of buf
+// with no complete message after it. Calling again from there (with more
+// data appended, for a stream) continues the index.
+size_t ant_index_frames(const uint8_t *buf, size_t len, size_t *offsets,
+                        size_t max, size_t *resume);
+
+#endif
@@ -0,0 +1,398 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "ant.h"
+#include "ant_port.h"
+#include "ant_metrics.h"
+
+#define REQUEST_MAX 1024     // Bytes of a request we look at
+#define REQUEST_TIMEOUT_S 1  // Scrapers that send nothing are dropped
+
+// Driver counters, in the order of metrics_names[]
+enum
+{
+  RX_BYTES, RX_FRAMES, CHECKSUM_ERRORS, LENGTH_ERRORS, RING_OVERFLOWS,
+  RX_FAILS, SEARCH_TIMEOUTS, REOPENS, STATS_COUNTERS
+};
+
+static const char *const metrics_names[STATS_COUNTERS][2] =
+{
+  { "ant_rx_bytes_total",        "Bytes received from the module" },
+  { "ant_rx_frames_total",       "Messages with a good checksum" },
+  { "ant_checksum_errors_total", "Messages with a bad checksum" },
+  { "ant_length_errors_total",   "Length bytes too big, i.e. false syncs" },
+  { "ant_ring_overflows_total",  "Bytes dropped because the RX ring was full" },
+  { "ant_rx_fails_total",        "Broadcasts the module missed (EVENT_RX_FAIL)" },
+  { "ant_search_timeouts_total", "Searches that timed out" },
+  { "ant_channel_reopens_total", "Channel re-opened after the module closed it" },
+};
+
+// Everything is written by one thread and read by the scrape thread
+typedef struct metrics_device
+{
+  uint8_t active;            // Driver counters published at least once
+  uint8_t queued;            // Queue depth published at least once
+  uint64_t stats[STATS_COUNTERS];
+  uint64_t ring_high_water;
+  uint64_t queue_depth;
+  uint64_t queue_dropped;
+  uint64_t buckets[ANT_METRICS_BUCKETS];
+  uint64_t latency_ns;
+  uint64_t calls;
+} metrics_device;
+
+static metrics_device devices[ANT_PORT_DEVICES];
+static int listen_fd = -1;
+static char unix_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static pthread_t server;
+
+static inline void publish(uint64_t *p, uint64_t v)
+{
+  __atomic_store_n(p, v, __ATOMIC_RELAXED);
+}
+
+// Single writer, so no read-modify-write instruction is needed
+static inline void add(uint64_t *p, uint64_t v)
+{
+  publish(p, __atomic_load_n(p, __ATOMIC_RELAXED) + v);
+}
+
+static inline uint64_t get(const uint64_t *p)
+{
+  return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+uint64_t ant_metrics_clock(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void ant_metrics_stats(ant_ctx *ctx)
+{
+  metrics_device *m;
+  ant_stats s;
+
+  if (ctx->config.usart >= ANT_PORT_DEVICES)
+    return;
+  m = &devices[ctx->config.usart];
+
+  ant_get_stats(ctx, &s);
+  publish(&m->stats[RX_BYTES], s.rx_bytes);
+  publish(&m->stats[RX_FRAMES], s.rx_frames);
+  publish(&m->stats[CHECKSUM_ERRORS], s.checksum_errors);
+  publish(&m->stats[LENGTH_ERRORS], s.length_errors);
+  publish(&m->stats[RING_OVERFLOWS], s.ring_overflows);
+  publish(&m->stats[RX_FAILS], s.rx_fails);
+  publish(&m->stats[SEARCH_TIMEOUTS], s.search_timeouts);
+  publish(&m->stats[REOPENS], s.reopens);
+  publish(&m->ring_high_water, s.ring_high_water);
+  __atomic_store_n(&m->active, 1, __ATOMIC_RELAXED);
+}
+
+void ant_metrics_queue(uint8_t dev, unsigned depth, unsigned long dropped)
+{
+  if (dev >= ANT_PORT_DEVICES)
+    return;
+
+  publish(&devices[dev].queue_depth, depth);
+  publish(&devices[dev].queue_dropped, dropped);
+  __atomic_store_n(&devices[dev].queued, 1, __ATOMIC_RELAXED);
+}
+
+void ant_metrics_latency(uint8_t dev, uint64_t ns)
+{
+  metrics_device *m;
+  uint64_t us = ns / 1000;
+  unsigned i = 0;
+
+  if (dev >= ANT_PORT_DEVICES)
+    return;
+  m = &devices[dev];
+
+  // Smallest power of two not below us
+  if (us > 1)
+    i = 64 - __builtin_clzll(us - 1);
+  if (i > ANT_METRICS_BUCKETS - 1)
+    i = ANT_METRICS_BUCKETS - 1;
+
+  add(&m->buckets[i], 1);
+  add(&m->latency_ns, ns);
+  add(&m->calls, 1);
+}
+
+static void write_metrics(FILE *f)
+{
+  metrics_device *m;
+  uint64_t total;
+  unsigned i, k;
+
+  for (k = 0; k < STATS_COUNTERS; k++)
+  {
+    fprintf(f, "# HELP %s %s.\n# TYPE %s counter\n", metrics_names[k][0],
+            metrics_names[k][1], metrics_names[k][0]);
+    for (i = 0; i < ANT_PORT_DEVICES; i++)
+    {
+      if (__atomic_load_n(&devices[i].active, __ATOMIC_RELAXED))
+        fprintf(f, "%s{device=\"%u\",channel=\"%u\"} %llu\n",
+                metrics_names[k][0], i, CHAN0,
+                (unsigned long long)get(&devices[i].stats[k]));
+    }
+  }
+
+  fputs("# HELP ant_ring_high_water_bytes Most bytes seen waiting in the "
+        "RX ring.\n# TYPE ant_ring_high_water_bytes gauge\n", f);
+  for (i = 0; i < ANT_PORT_DEVICES; i++)
+  {
+    if (__atomic_load_n(&devices[i].active, __ATOMIC_RELAXED))
+      fprintf(f, "ant_ring_high_water_bytes{device=\"%u\",channel=\"%u\"} "
+              "%llu\n", i, CHAN0,
+              (unsigned long long)get(&devices[i].ring_high_water));
+  }
+
+  fputs("# HELP ant_queue_depth Frames waiting for the handler.\n"
+        "# TYPE ant_queue_depth gauge\n", f);
+  for (i = 0; i < ANT_PORT_DEVICES; i++)
+  {
+    if (__atomic_load_n(&devices[i].queued, __ATOMIC_RELAXED))
+      fprintf(f, "ant_queue_depth{device=\"%u\",channel=\"%u\"} %llu\n",
+              i, CHAN0, (unsigned long long)get(&devices[i].queue_depth));
+  }
+
+  fputs("# HELP ant_queue_dropped_total Frames dropped because the handler "
+        "fell behind.\n# TYPE ant_queue_dropped_total counter\n", f);
+  for (i = 0; i < ANT_PORT_DEVICES; i++)
+  {
+    if (__atomic_load_n(&devices[i].queued, __ATOMIC_RELAXED))
+      fprintf(f, "ant_queue_dropped_total{device=\"%u\",channel=\"%u\"} "
+              "%llu\n", i, CHAN0,
+              (unsigned long long)get(&devices[i].queue_dropped));
+  }
+
+  fputs("# HELP ant_handler_latency_seconds Time spent handling a "
+        "broadcast.\n# TYPE ant_handler_latency_seconds histogram\n", f);
+  for (i = 0; i < ANT_PORT_DEVICES; i++)
+  {
+    m = &devices[i];
+    if (!__atomic_load_n(&m->active, __ATOMIC_RELAXED) &&
+        !__atomic_load_n(&m->queued, __ATOMIC_RELAXED))
+      continue;
+
+    // Buckets are cumulative; the count is their sum, so the histogram
+    // stays consistent even if calls are recorded while we read
+    for (k = 0, total = 0; k < ANT_METRICS_BUCKETS - 1; k++)
+    {
+      total += get(&m->buckets[k]);
+      fprintf(f, "ant_handler_latency_seconds_bucket{device=\"%u\","
+              "channel=\"%u\",le=\"%g\"} %llu\n", i, CHAN0,
+              (double)(1ULL << k) / 1e6, (unsigned long long)total);
+    }
+    total += get(&m->buckets[k]);
+    fprintf(f, "ant_handler_latency_seconds_bucket{device=\"%u\","
+            "channel=\"%u\",le=\"+Inf\"} %llu\n", i, CHAN0,
+            (unsigned long long)total);
+    fprintf(f, "ant_handler_latency_seconds_sum{device=\"%u\","
+            "channel=\"%u\"} %.9f\n", i, CHAN0,
+            (double)get(&m->latency_ns) / 1e9);
+    fprintf(f, "ant_handler_latency_seconds_count{device=\"%u\","
+            "channel=\"%u\"} %llu\n", i, CHAN0, (unsigned long long)total);
+  }
+}
+
+static int send_all(int fd, const char *buf, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0)
+  {
+    n = send(fd, buf, len, MSG_NOSIGNAL);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+// Reads the request head and answers GET /metrics (or /) with the
+// exposition, anything else with 404. HTTP/1.0, one request per
+// connection.
+static void serve(int fd)
+{
+  struct timeval tv = { REQUEST_TIMEOUT_S, 0 };
+  char req[REQUEST_MAX + 1], head[160];
+  char *body = NULL;
+  size_t body_len = 0;
+  size_t n = 0;
+  ssize_t r;
+  FILE *f;
+  int ok;
+
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  while (n < REQUEST_MAX)
+  {
+    r = recv(fd, req + n, REQUEST_MAX - n, 0);
+    if (r <= 0)
+      break;
+    n += r;
+    req[n] = '\0';
+    if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+      break;
+  }
+  req[n] = '\0';
+
+  ok = !strncmp(req, "GET /metrics ", 13) || !strncmp(req, "GET / ", 6) ||
+       !strncmp(req, "GET /metrics?", 13);
+  if (!ok)
+  {
+    static const char not_found[] =
+      "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n"
+      "Connection: close\r\n\r\n";
+    send_all(fd, not_found, sizeof(not_found) - 1);
+    return;
+  }
+
+  f = open_memstream(&body, &body_len);
+  if (!f)
+    return;
+  write_metrics(f);
+  fclose(f);
+
+  n = snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\n"
+               "Content-Type: text/plain; version=0.0.4\r\n"
+               "Content-Length: %zu\r\nConnection: close\r\n\r\n", body_len);
+  if (send_all(fd, head, n) == 0)
+    send_all(fd, body, body_len);
+  free(body);
+}
+
+static void *server_main(void *arg)
+{
+  int fd;
+
+  for (;;)
+  {
+    fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0)
+    {
+      // shutdown() in ant_metrics_stop() ends the loop
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      break;
+    }
+    serve(fd);
+    close(fd);
+  }
+
+  return NULL;
+}
+
+int ant_metrics_start(const char *addr)
+{
+  struct sockaddr_un sun;
+  struct sockaddr_in sin;
+  char *end;
+  long port;
+  int err;
+
+  if (!strncmp(addr, "unix:", 5))
+  {
+    addr += 5;
+    if (strlen(addr) >= sizeof(sun.sun_path))
+    {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, addr);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0)
+      return -1;
+    // A socket left behind by an earlier run would fail the bind
+    unlink(addr);
+    if (bind(listen_fd, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+      goto fail;
+    strcpy(unix_path, addr);
+  }
+  else
+  {
+    port = strtol(addr, &end, 10);
+    if (*addr == '\0' || *end != '\0' || port <= 0 || port > 65535)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0)
+      return -1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &(int){ 1 }, sizeof(int));
+    if (bind(listen_fd, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+      goto fail;
+  }
+
+  if (listen(listen_fd, 8) < 0)
+    goto fail;
+
+  err = pthread_create(&server, NULL, &server_main, NULL);
+  if (err)
+  {
+    errno = err;
+    goto fail;
+  }
+
+  return 0;
+
+fail:
+  err = errno;
+  close(listen_fd);
+  listen_fd = -1;
+  if (unix_path[0])
+  {
+    unlink(unix_path);
+    unix_path[0] = '\0';
+  }
+  errno = err;
+  return -1;
+}
+
+void ant_metrics_stop(void)
+{
+  if (listen_fd < 0)
+    return;
+
+  shutdown(listen_fd, SHUT_RDWR);
+  pthread_join(server, NULL);
+  close(listen_fd);
+  listen_fd = -1;
+
+  if (unix_path[0])
+  {
+    unlink(unix_path);
+    unix_path[0] = '\0';
+  }
+}
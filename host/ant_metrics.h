@@ -0,0 +1,55 @@
+/* Prometheus metrics for the Linux gateway.
+
+   Every counter has exactly one writer: the thread that owns the device's
+   context publishes its driver counters and queue depth, the thread that
+   runs its handler records handler latency. Writers store plain 64 bit
+   values with relaxed atomics and never wait; the scrape thread only
+   loads them. So a scrape never contends with decoding, it may just see
+   one device a few frames further along than another.
+
+   Served as text exposition format 0.0.4 over HTTP, either on a TCP port
+   of 127.0.0.1 or on a Unix socket:
+
+     curl -s localhost:9464/metrics
+     curl -s --unix-socket /run/ant.sock http://x/metrics
+
+   Every device has the labels device (its ant_configuration.usart) and
+   channel. The driver's 16 bit counters wrap, which Prometheus handles as
+   a counter reset; frame rates come from rate(ant_rx_frames_total[1m]). */
+
+#ifndef ANT_METRICS_H
+#define ANT_METRICS_H
+
+#include <stdint.h>
+
+#include "ant.h"
+
+// Handler latency histogram: buckets of up to 2^i microseconds, the last
+// one taking everything slower
+#if !defined(ANT_METRICS_BUCKETS)
+  #define ANT_METRICS_BUCKETS 16
+#endif
+
+// Starts the scrape thread on addr: "unix:<path>" for a Unix socket,
+// otherwise a port on 127.0.0.1. Returns 0, or -1 with errno set.
+int ant_metrics_start(const char *addr);
+
+// Stops the scrape thread and removes the Unix socket
+void ant_metrics_stop(void);
+
+// Publishes the driver counters of ctx. Call from the thread owning ctx,
+// e.g. after each ant_host_read() or ant_host_poll().
+void ant_metrics_stats(ant_ctx *ctx);
+
+// Publishes the frames waiting for dev's handler and the frames dropped
+// so far. Call from one thread per device.
+void ant_metrics_queue(uint8_t dev, unsigned depth, unsigned long dropped);
+
+// Records one handler call for dev that took ns nanoseconds. Call from
+// the thread running dev's handler.
+void ant_metrics_latency(uint8_t dev, uint64_t ns);
+
+// Monotonic clock in nanoseconds for ant_metrics_latency()
+uint64_t ant_metrics_clock(void);
+
+#endif
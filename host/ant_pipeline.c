@@ -0,0 +1,288 @@
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "ant.h"
+#include "ant_port.h"
+#include "ant_host.h"
+#include "ant_metrics.h"
+#include "ant_pipeline.h"
+
+#define QUEUE_MASK (ANT_PIPELINE_QUEUE_SIZE - 1)
+
+// How often readers look at the stop flag
+#define READ_TIMEOUT_MS 100
+
+typedef struct pipeline_consumer pipeline_consumer;
+
+// Single producer (the reader) / single consumer ring of frames. Indices
+// run freely and are masked on access; each side only writes its own.
+typedef struct pipeline_queue
+{
+  ant_frame slots[ANT_PIPELINE_QUEUE_SIZE];
+  unsigned head;
+  unsigned tail;
+  unsigned long dropped;
+} pipeline_queue;
+
+typedef struct pipeline_reader
+{
+  pthread_t thread;
+  uint8_t started;
+  ant_ctx ctx;
+  ant_configuration config;
+  pipeline_queue queue;
+  pipeline_consumer *consumer;
+} pipeline_reader;
+
+struct pipeline_consumer
+{
+  pthread_t thread;
+  uint8_t started;
+  int event_fd;              // Readers post here while it sleeps
+  int sleeping;
+  pipeline_reader *queues[ANT_PORT_DEVICES];
+  uint8_t n_queues;
+};
+
+// Indexed by device
+static pipeline_reader readers[ANT_PORT_DEVICES];
+static pipeline_consumer consumers[ANT_PIPELINE_MAX_CONSUMERS];
+static uint8_t n_consumers;
+
+static int readers_running;
+static int consumers_running;
+static ant_pipeline_handler handler;
+static void *handler_arg;
+
+static void pipeline_wake(pipeline_consumer *c)
+{
+  eventfd_write(c->event_fd, 1);
+}
+
+// Broadcast callback, on the reader thread
+static void pipeline_recv(ant_ctx *ctx, uint8_t *buf, uint8_t len)
+{
+  pipeline_reader *r = &readers[ctx->config.usart];
+  pipeline_queue *q = &r->queue;
+  unsigned head = q->head;
+  ant_frame *frame;
+
+  if (head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) ==
+      ANT_PIPELINE_QUEUE_SIZE)
+  {
+    __atomic_add_fetch(&q->dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  frame = &q->slots[head & QUEUE_MASK];
+  frame->dev = ctx->config.usart;
+  frame->len = len;
+  memcpy(frame->data, buf, len);
+  __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+
+  // Pairs with the fence in consumer_main(): either the consumer sees the
+  // new head before sleeping, or we see it asleep
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&r->consumer->sleeping, __ATOMIC_RELAXED))
+    pipeline_wake(r->consumer);
+}
+
+static void *reader_main(void *arg)
+{
+  pipeline_reader *r = arg;
+  pipeline_queue *q = &r->queue;
+
+  ant_init(&r->ctx, r->config);
+
+  while (__atomic_load_n(&readers_running, __ATOMIC_RELAXED))
+  {
+    if (ant_host_read(r->config.usart, READ_TIMEOUT_MS) < 0)
+      break;
+
+    ant_metrics_stats(&r->ctx);
+    ant_metrics_queue(r->config.usart,
+                      q->head - __atomic_load_n(&q->tail, __ATOMIC_RELAXED),
+                      __atomic_load_n(&q->dropped, __ATOMIC_RELAXED));
+  }
+
+  return NULL;
+}
+
+// Hands every queued frame to the handler, returns how many there were.
+// A slot is only given back once the handler is done with it.
+static unsigned consumer_drain(pipeline_consumer *c)
+{
+  pipeline_queue *q;
+  unsigned head, tail, n = 0;
+  uint64_t start;
+  uint8_t i;
+
+  for (i = 0; i < c->n_queues; i++)
+  {
+    q = &c->queues[i]->queue;
+    tail = q->tail;
+    head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+
+    for ( ; tail != head; tail++, n++)
+    {
+      start = ant_metrics_clock();
+      handler(&q->slots[tail & QUEUE_MASK], handler_arg);
+      ant_metrics_latency(q->slots[tail & QUEUE_MASK].dev,
+                          ant_metrics_clock() - start);
+      __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    }
+  }
+
+  return n;
+}
+
+static void *consumer_main(void *arg)
+{
+  pipeline_consumer *c = arg;
+  eventfd_t value;
+
+  while (1)
+  {
+    if (consumer_drain(c) > 0)
+      continue;
+
+    if (!__atomic_load_n(&consumers_running, __ATOMIC_ACQUIRE))
+      break;
+
+    __atomic_store_n(&c->sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (consumer_drain(c) == 0 &&
+        __atomic_load_n(&consumers_running, __ATOMIC_ACQUIRE))
+      eventfd_read(c->event_fd, &value);
+    __atomic_store_n(&c->sleeping, 0, __ATOMIC_RELAXED);
+  }
+
+  return NULL;
+}
+
+int ant_pipeline_start(const ant_configuration *configs, uint8_t n,
+                       uint8_t consumers_n, ant_pipeline_handler h,
+                       void *arg)
+{
+  pipeline_reader *r;
+  pipeline_consumer *c;
+  uint8_t i;
+  int err;
+
+  if (n == 0 || consumers_n == 0 || consumers_n > ANT_PIPELINE_MAX_CONSUMERS)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset(readers, 0, sizeof(readers));
+  memset(consumers, 0, sizeof(consumers));
+  for (i = 0; i < ANT_PIPELINE_MAX_CONSUMERS; i++)
+    consumers[i].event_fd = -1;
+
+  for (i = 0; i < n; i++)
+  {
+    r = (configs[i].usart < ANT_PORT_DEVICES) ? &readers[configs[i].usart] : 0;
+    if (!r || r->config.callback_broadcast_recv)  // Bad or repeated device
+    {
+      errno = EINVAL;
+      return -1;
+    }
+    r->config = configs[i];
+    r->config.callback_broadcast_recv = &pipeline_recv;
+  }
+
+  // More consumers than devices would have nothing to do
+  n_consumers = (consumers_n > n) ? n : consumers_n;
+  handler = h;
+  handler_arg = arg;
+  readers_running = 1;
+  consumers_running = 1;
+
+  for (i = 0; i < n_consumers; i++)
+  {
+    consumers[i].event_fd = eventfd(0, EFD_CLOEXEC);
+    if (consumers[i].event_fd < 0)
+      goto fail;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    r = &readers[configs[i].usart];
+    c = &consumers[i % n_consumers];
+    r->consumer = c;
+    c->queues[c->n_queues++] = r;
+  }
+
+  for (i = 0; i < n_consumers; i++)
+  {
+    err = pthread_create(&consumers[i].thread, NULL, consumer_main,
+                         &consumers[i]);
+    if (err != 0)
+    {
+      errno = err;
+      goto fail;
+    }
+    consumers[i].started = TRUE;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    r = &readers[configs[i].usart];
+    err = pthread_create(&r->thread, NULL, reader_main, r);
+    if (err != 0)
+    {
+      errno = err;
+      goto fail;
+    }
+    r->started = TRUE;
+  }
+
+  return 0;
+
+fail:
+  err = errno;
+  ant_pipeline_stop();
+  errno = err;
+  return -1;
+}
+
+void ant_pipeline_stop(void)
+{
+  uint8_t i;
+
+  __atomic_store_n(&readers_running, 0, __ATOMIC_RELAXED);
+  for (i = 0; i < ANT_PORT_DEVICES; i++)
+  {
+    if (readers[i].started)
+      pthread_join(readers[i].thread, NULL);
+    readers[i].started = FALSE;
+  }
+
+  // Everything the readers queued is handled before the consumers exit
+  __atomic_store_n(&consumers_running, 0, __ATOMIC_RELEASE);
+  for (i = 0; i < n_consumers; i++)
+  {
+    if (consumers[i].started)
+    {
+      pipeline_wake(&consumers[i]);
+      pthread_join(consumers[i].thread, NULL);
+    }
+    consumers[i].started = FALSE;
+    if (consumers[i].event_fd >= 0)
+      close(consumers[i].event_fd);
+    consumers[i].event_fd = -1;
+  }
+  n_consumers = 0;
+}
+
+unsigned long ant_pipeline_dropped(uint8_t dev)
+{
+  if (dev >= ANT_PORT_DEVICES)
+    return 0;
+
+  return __atomic_load_n(&readers[dev].queue.dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,61 @@
+/* Multithreaded gateway pipeline for the Linux port.
+
+   Every device gets a reader thread that owns its context: it runs
+   ant_init() and then reads the device with ant_host_read(), so parsing
+   and dispatch happen there, exactly as in the single threaded gateway.
+   Received broadcasts are copied into preallocated slots of a lock-free
+   single producer/single consumer queue per device. The queues are dealt
+   out round robin to a fixed number of consumer threads, which drain them
+   and call the handler. Nothing is allocated per frame, each device's
+   frames stay in order and parsers share no state, so decoding scales
+   with the devices and handling with the consumers.
+
+   Readers publish their driver counters and queue depth and consumers the
+   handler latency, see ant_metrics.h.
+
+   Devices must be opened with ant_host_open() first. A context belongs to
+   its reader thread, so handlers must not call the driver. */
+
+#ifndef ANT_PIPELINE_H
+#define ANT_PIPELINE_H
+
+#include <stdint.h>
+
+#include "ant.h"
+
+// Frames buffered per device (power of two). A full queue drops the new
+// frame and counts it, see ant_pipeline_dropped().
+#if !defined(ANT_PIPELINE_QUEUE_SIZE)
+  #define ANT_PIPELINE_QUEUE_SIZE 256
+#endif
+#if !defined(ANT_PIPELINE_MAX_CONSUMERS)
+  #define ANT_PIPELINE_MAX_CONSUMERS 16
+#endif
+
+// A received message as the parser saw it: sync, length, id, data
+typedef struct ant_frame
+{
+  uint8_t dev;               // ant_configuration.usart it came in on
+  uint8_t len;               // Bytes in data, without the checksum
+  uint8_t data[ANT_RX_MSG_SIZE];
+} ant_frame;
+
+typedef void (*ant_pipeline_handler)(const ant_frame *frame, void *arg);
+
+// Starts a reader thread for each of the n configurations (their usart
+// fields must differ; callbacks are replaced by the pipeline's) and
+// consumers consumer threads calling handler(frame, arg). Returns 0, or -1
+// with errno set.
+int ant_pipeline_start(const ant_configuration *configs, uint8_t n,
+                       uint8_t consumers, ant_pipeline_handler handler,
+                       void *arg);
+
+// Stops the readers, lets the consumers finish what was queued, and joins
+// every thread
+void ant_pipeline_stop(void);
+
+// Frames a device dropped because its consumer fell behind. Still valid
+// after ant_pipeline_stop().
+unsigned long ant_pipeline_dropped(uint8_t dev);
+
+#endif
@@ -0,0 +1,92 @@
+// Indexes the messages in a capture of raw ANT serial traffic. The file is
+// mmap'd and the offset of every well-formed message is written to stdout,
+// one per line, or as little-endian 64-bit values with -b. Counts and
+// throughput go to stderr.
+//
+//   capindex [-b] capture.bin > index
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ant_index.h"
+
+// Offsets collected per ant_index_frames() call
+#define BATCH 65536
+
+static size_t offsets[BATCH];
+
+int main(int argc, char **argv)
+{
+  struct timespec t0, t1;
+  struct stat st;
+  const uint8_t *buf;
+  size_t pos = 0, next, total = 0, n, i;
+  uint64_t out;
+  double secs;
+  int binary = 0, opt, fd;
+
+  while ((opt = getopt(argc, argv, "b")) != -1)
+  {
+    if (opt != 'b')
+      goto usage;
+    binary = 1;
+  }
+  if (optind != argc - 1)
+    goto usage;
+
+  fd = open(argv[optind], O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0)
+  {
+    perror(argv[optind]);
+    return 1;
+  }
+  if (st.st_size == 0)
+    return 0;
+
+  buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (buf == MAP_FAILED)
+  {
+    perror("mmap");
+    return 1;
+  }
+  madvise((void *)buf, st.st_size, MADV_SEQUENTIAL);
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  while (pos < (size_t)st.st_size)
+  {
+    n = ant_index_frames(buf + pos, st.st_size - pos, offsets, BATCH, &next);
+
+    for (i = 0; i < n; i++)
+    {
+      out = pos + offsets[i];
+      if (binary)
+        fwrite(&out, sizeof(out), 1, stdout);
+      else
+        printf("%llu\n", (unsigned long long)out);
+    }
+
+    total += n;
+    // Short of a full batch the rest of the file has been searched, and
+    // anything left over is cut off by its end
+    if (n < BATCH)
+      break;
+    pos += next;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+  fprintf(stderr, "%zu messages in %lld bytes, %.3fs (%.1f MB/s)\n", total,
+          (long long)st.st_size, secs,
+          secs > 0 ? st.st_size / secs / 1e6 : 0.0);
+
+  return 0;
+
+usage:
+  fprintf(stderr, "usage: %s [-b] capture\n", argv[0]);
+  return 1;
+}
@@ -0,0 +1,170 @@
+// Replays a capture through the driver. The messages each device received
+// are fed to a context of its own with ant_feed(), so they go through
+// ant_handle_msg() and dispatch exactly like live traffic; the messages
+// the driver sent are skipped. Broadcasts are printed like the gateway
+// does, and the totals and throughput go to stderr.
+//
+//   capreplay [-f] [-q] capture
+//
+// -f replays as fast as possible instead of at the original pace, which
+// makes a capture a benchmark of the parser; -q doesn't print messages.
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ant.h"
+#include "ant_port.h"
+#include "ant_capture.h"
+
+static ant_ctx radios[ANT_PORT_DEVICES];
+static uint8_t ready[ANT_PORT_DEVICES];
+static int quiet;
+
+static void callback_broadcast_recv(ant_ctx *ctx, uint8_t *buf, uint8_t len)
+{
+  uint8_t i;
+
+  if (quiet)
+    return;
+
+  printf("%u %u:", ctx->config.usart, buf[4] | (buf[5] << 8));
+  for (i = 6; i < len; i++)
+    printf(" %02x", buf[i]);
+  printf("\n");
+}
+
+static uint64_t now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Sleeps until t microseconds on the monotonic clock
+static void sleep_until(uint64_t t)
+{
+  struct timespec ts;
+
+  ts.tv_sec = t / 1000000;
+  ts.tv_nsec = (t % 1000000) * 1000;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    ;
+}
+
+// The first message from a device sets up its context. The driver's
+// configuration messages go nowhere, no device is open.
+static void setup(uint8_t dev)
+{
+  ant_configuration config;
+
+  memset(&config, 0, sizeof(config));
+  config.usart     = dev;
+  config.master    = FALSE;
+  config.frequency = 0x41;
+  config.period    = 2370;
+  config.callback_broadcast_recv = &callback_broadcast_recv;
+
+  ant_init(&radios[dev], config);
+  ready[dev] = TRUE;
+}
+
+int main(int argc, char **argv)
+{
+  ant_capture cap;
+  ant_capture_record rec;
+  ant_stats stats;
+  uint64_t start = 0, first = 0, frames = 0, bytes = 0, skipped = 0, t;
+  double secs;
+  int fast = 0, opt, rc;
+  uint8_t i;
+
+  while ((opt = getopt(argc, argv, "fq")) != -1)
+  {
+    switch (opt)
+    {
+      case 'f':
+        fast = 1;
+        break;
+      case 'q':
+        quiet = 1;
+        break;
+      default:
+        goto usage;
+    }
+  }
+  if (optind != argc - 1)
+    goto usage;
+
+  if (ant_capture_open(&cap, argv[optind]) < 0)
+  {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  while ((rc = ant_capture_read(&cap, &rec)) > 0)
+  {
+    if (rec.dir != ANT_FRAME_RX || rec.dev >= ANT_PORT_DEVICES)
+    {
+      skipped++;
+      continue;
+    }
+
+    // Setting up includes the driver's reset delay, which mustn't count
+    // towards the pace or the throughput
+    if (!ready[rec.dev])
+    {
+      t = now_us();
+      setup(rec.dev);
+      if (start != 0)
+        start += now_us() - t;
+    }
+
+    if (start == 0)
+    {
+      start = now_us();
+      first = rec.time_us;
+    }
+    else if (!fast)
+    {
+      sleep_until(start + (rec.time_us - first));
+    }
+
+    ant_feed(&radios[rec.dev], rec.frame, rec.len);
+    frames++;
+    bytes += rec.len;
+  }
+  t = now_us();
+  fflush(stdout);
+
+  if (rc < 0)
+    fprintf(stderr, "%s: corrupt or truncated capture\n", argv[optind]);
+
+  secs = start ? (t - start) / 1e6 : 0;
+  fprintf(stderr, "%llu messages (%llu bytes) replayed, %llu skipped, "
+          "%.3fs", (unsigned long long)frames, (unsigned long long)bytes,
+          (unsigned long long)skipped, secs);
+  if (secs > 0)
+    fprintf(stderr, " (%.0f messages/s, %.1f MB/s)", frames / secs,
+            bytes / secs / 1e6);
+  fprintf(stderr, "\n");
+
+  for (i = 0; i < ANT_PORT_DEVICES; i++)
+  {
+    if (!ready[i])
+      continue;
+    ant_get_stats(&radios[i], &stats);
+    fprintf(stderr, "  device %u: %lu frames, %u checksum errors\n", i,
+            (unsigned long)stats.rx_frames, stats.checksum_errors);
+  }
+
+  ant_capture_close(&cap);
+  return (rc < 0) ? 1 : 0;
+
+usage:
+  fprintf(stderr, "usage: %s [-f] [-q] capture\n", argv[0]);
+  return 1;
+}
@@ -0,0 +1,203 @@
+// Collects broadcasts from every ANT device named on the command line and
+// prints one line per message: device, sender address and payload, or the
+// samples of a packed message (see ../sample_pack.h).
+//
+//   gateway [-b baud] [-t consumers] [-w capture] [-m port|unix:path]
+//           /dev/ttyUSB0 ...
+//
+// With -t every device gets a reader thread and messages are printed by
+// the given number of consumer threads (see ant_pipeline.h); otherwise
+// everything runs on one epoll loop. With -w all traffic is also appended
+// to a capture file, see ant_capture.h and capreplay. With -m Prometheus
+// metrics are served on a port of localhost or a Unix socket, see
+// ant_metrics.h.
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ant.h"
+#include "ant_port.h"
+#include "ant_host.h"
+#include "ant_pipeline.h"
+#include "ant_capture.h"
+#include "ant_metrics.h"
+#include "sample_pack.h"
+
+static ant_ctx radios[ANT_PORT_DEVICES];
+static ant_capture capture;
+static volatile sig_atomic_t stop;
+
+// One line per message, written in one go so threads don't interleave
+static void print_msg(uint8_t dev, uint8_t *buf, uint8_t len)
+{
+  char line[64 + 3 * ANT_RX_MSG_SIZE + 5 * SAMPLE_PACK_MAX];
+  uint16_t samples[SAMPLE_PACK_MAX];
+  uint8_t i, count = 0;
+  int n;
+
+  n = sprintf(line, "%u %u:", dev, buf[4] | (buf[5] << 8));
+  if (len >= 6 + SAMPLE_PACK_SIZE)
+    count = sample_unpack(buf + 6, samples);
+  if (count > 0)
+  {
+    n += sprintf(line + n, " samples");
+    for (i = 0; i < count; i++)
+      n += sprintf(line + n, " %u", samples[i]);
+  }
+  else
+  {
+    for (i = 6; i < len; i++)
+      n += sprintf(line + n, " %02x", buf[i]);
+  }
+  line[n++] = '\n';
+  fwrite(line, 1, n, stdout);
+  fflush(stdout);
+}
+
+static void callback_broadcast_recv(ant_ctx *ctx, uint8_t *buf, uint8_t len)
+{
+  uint64_t start = ant_metrics_clock();
+
+  print_msg(ctx->config.usart, buf, len);
+  ant_metrics_latency(ctx->config.usart, ant_metrics_clock() - start);
+}
+
+static void callback_frame(ant_ctx *ctx, uint8_t dir, const uint8_t *buf,
+                           uint8_t len)
+{
+  if (ant_capture_write(&capture, ant_capture_now(), ctx->config.usart,
+                        dir, buf) < 0)
+    perror("capture");
+}
+
+static void handle_frame(const ant_frame *frame, void *arg)
+{
+  print_msg(frame->dev, (uint8_t *)frame->data, frame->len);
+}
+
+// SIGINT/SIGTERM: leave the loop so the capture is flushed and closed
+static void handle_signal(int sig)
+{
+  stop = 1;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-b baud] [-t consumers] [-w capture] "
+          "[-m port|unix:path] device... (1-%d devices)\n", name,
+          ANT_PORT_DEVICES);
+}
+
+int main(int argc, char **argv)
+{
+  ant_configuration configs[ANT_PORT_DEVICES];
+  struct sigaction sa;
+  uint32_t baud = 57600;
+  const char *metrics = NULL;
+  int consumers = 0;
+  int opt, i, n;
+
+  while ((opt = getopt(argc, argv, "b:t:w:m:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'b':
+        baud = strtoul(optarg, NULL, 10);
+        break;
+      case 't':
+        consumers = atoi(optarg);
+        break;
+      case 'w':
+        if (ant_capture_append(&capture, optarg) < 0)
+        {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      case 'm':
+        metrics = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  n = argc - optind;
+  if (n < 1 || n > ANT_PORT_DEVICES)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // No SA_RESTART, so a blocked epoll_wait() or pause() returns
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handle_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  if (metrics && ant_metrics_start(metrics) < 0)
+  {
+    perror(metrics);
+    return 1;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    if (ant_host_open(i, argv[optind + i], baud) < 0)
+    {
+      perror(argv[optind + i]);
+      return 1;
+    }
+
+    // Same channel as the AVR example, but pair with any master
+    memset(&configs[i], 0, sizeof(configs[i]));
+    configs[i].usart     = i;
+    configs[i].address   = 1;
+    configs[i].master    = FALSE;
+    configs[i].frequency = 0x41;
+    configs[i].period    = 2370;
+    configs[i].callback_broadcast_recv = &callback_broadcast_recv;
+    if (capture.file)
+      configs[i].callback_frame = &callback_frame;
+  }
+
+  if (consumers > 0)
+  {
+    if (ant_pipeline_start(configs, n, consumers, &handle_frame, NULL) < 0)
+    {
+      perror("pipeline");
+      return 1;
+    }
+    while (!stop)
+      pause();
+    ant_pipeline_stop();
+  }
+  else
+  {
+    for (i = 0; i < n && !stop; i++)
+    {
+      ant_init(&radios[i], configs[i]);
+      ant_metrics_stats(&radios[i]);
+    }
+
+    while (!stop)
+    {
+      if (ant_host_poll(-1) < 0)
+      {
+        perror("epoll");
+        break;
+      }
+      for (i = 0; i < n; i++)
+        ant_metrics_stats(&radios[i]);
+    }
+  }
+
+  ant_metrics_stop();
+  if (capture.file)
+    ant_capture_close(&capture);
+  return 0;
+}
@@ -0,0 +1,91 @@
+// Regression cases for ant_index_frames(), run by "make check"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ant.h"
+#include "ant_index.h"
+
+static uint8_t buf[256];
+static size_t len;
+
+// Appends a broadcast with one varying data byte and a good checksum
+static size_t put_broadcast(uint8_t tag)
+{
+  size_t start = len;
+  uint8_t i, chk = 0;
+
+  buf[len++] = MESG_TX_SYNC;
+  buf[len++] = 9;
+  buf[len++] = MESG_BROADCAST_DATA_ID;
+  for (i = 0; i < 9; i++)
+    buf[len++] = (i == 1) ? tag : i;
+  for (i = 0; i < 12; i++)
+    chk ^= buf[start + i];
+  buf[len++] = chk;
+
+  return start;
+}
+
+static void put(const uint8_t *bytes, size_t n)
+{
+  memcpy(buf + len, bytes, n);
+  len += n;
+}
+
+static int check(const char *name, size_t max, size_t want_found,
+                 size_t want_resume)
+{
+  size_t offsets[16], found, resume;
+
+  found = ant_index_frames(buf, len, offsets, max, &resume);
+  if (found == want_found && resume == want_resume)
+    return 0;
+
+  printf("%s: %zu messages, resume at %zu (expected %zu, %zu)\n", name,
+         found, resume, want_found, want_resume);
+  return 1;
+}
+
+int main(void)
+{
+  static const uint8_t false_sync[] = { MESG_TX_SYNC, 0x0E };
+  size_t tail;
+  int failed = 0;
+
+  // A false sync whose length runs past the end doesn't hide what follows
+  len = 0;
+  put_broadcast(1);
+  put_broadcast(2);
+  put_broadcast(3);
+  put(false_sync, sizeof(false_sync));
+  put_broadcast(4);
+  failed += check("false sync", 16, 4, len);
+
+  // A message cut off by the end is where to resume
+  len = 0;
+  put_broadcast(1);
+  tail = put_broadcast(2);
+  len -= 3;
+  failed += check("cut off", 16, 1, tail);
+
+  // ... and so is the first of several unresolved syncs
+  len = 0;
+  put_broadcast(1);
+  tail = len;
+  put(false_sync, sizeof(false_sync));
+  put_broadcast(2);
+  len -= 3;
+  failed += check("unresolved", 16, 1, tail);
+
+  // A full batch resumes after its last message
+  len = 0;
+  put_broadcast(1);
+  tail = put_broadcast(2);
+  put_broadcast(3);
+  failed += check("full batch", 1, 1, tail);
+
+  if (failed == 0)
+    printf("index: all passed\n");
+  return failed ? 1 : 0;
+}
@@ -8,6 +8,7 @@
 #define FOSC 8000000 // 8MHz
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <stdio.h>
 #include <avr/io.h>
@@ -16,97 +17,122 @@
 
 #include "softuart.h"
 #include "ant.h"
+#include "adc_sampler.h"
+#include "nr_stats.h"
+#include "sample_pack.h"
 
 #define BAUD 4800
 #define MYUBRR 103 // Calculated from http://www.wormfood.net/avrbaudcalc.php
 
+// ADC0 is recorded every SAMPLE_EVERY sampler generations (~280 a second),
+// i.e. about 5 samples per channel period
+#define SAMPLE_EVERY 4
+
 // Define functions
 //=======================
 void ioinit(void);                             // initializes IO
 void uart_putchar(char c);                     // sends char out of UART
 uint8_t uart_getchar(void);                    // receives char from UART
-void callback_broadcast_recv(uint8_t *buf, uint8_t len);
+void callback_broadcast_recv(ant_ctx *ctx, uint8_t *buf, uint8_t len);
+void record_sample(void);                      // queues ADC0 for sending
 //=======================
 
+static ant_ctx radio;
+
+// ADC0 readings waiting to be sent, oldest first
+static uint16_t pending[SAMPLE_PACK_MAX];
+static uint8_t pending_n;
+
 static int my_stdio_putchar( char c, FILE *stream );
 FILE suart_stream = FDEV_SETUP_STREAM( my_stdio_putchar, NULL, _FDEV_SETUP_WRITE );
 
-void callback_broadcast_recv(uint8_t *buf, uint8_t len)
+void callback_broadcast_recv(ant_ctx *ctx, uint8_t *buf, uint8_t len)
 {
-  uint8_t data[6];
-  uint8_t i;
-  uint8_t adc_val;
-
-  /* Check if this is a NR stats message, if so, print it.
-  /  buf[7] will hold the NR stat id:
-     0: Apdex
-     1: Error Rate
-     2: Throughput
-     3: Response Time
-     4: DB
-     5: CPU
-     6: Memory
-     buf[8] and buf[9] hold the value (little endian)
-  */
-  if (buf[6] == 0x2a) {
-    printf("d: ");
-    for (i = 6; i < len; i++) {
-      printf("%x ", buf[i]);
-    }
-    printf("\n");
+  uint8_t data[SAMPLE_PACK_SIZE];
+  uint8_t n;
+  nr_stat stat;
+  nr_stat_summary summary;
+
+  // NR stats message: fold it into the rolling window and print the
+  // summary for that stat
+  if (nr_stats_decode(buf, len, &stat)) {
+    nr_stats_add(&stat);
+    nr_stats_summary(stat.id, &summary);
+    printf("nr %u: %u min %u max %u avg %u\n", stat.id, summary.last,
+           summary.min, summary.max, summary.ewma);
   }
 
-  // Read from ADC0 and send it as data1
-  ADCSRA |= (1 << ADSC);            // start ADC conversion
-  while (ADCSRA & (1 << ADSC)) {;}; // wait for the result to be available
-  adc_val = ADCH;
-  printf("val: %i\n", adc_val);
-
-  // At this point, we can transmit our data.
-  // The protocol allows for 3 16 bit (little endian) data points.
-  data[0] = adc_val;   // Data 1
-  data[1] = 0x00;
-  data[2] = 0x00;   // Data 2
-  data[3] = 0x00;
-  data[4] = 0x00;   // Data 3
-  data[5] = 0x00;
-
-  ant_send_broadcast_data(1, data);
+  // At this point, we can transmit our data: as many of the recorded
+  // ADC0 readings as fit (3 to 8, see sample_pack.h), the rest go next time
+  if (pending_n == 0)
+    pending[pending_n++] = adc_sampler_read(0);
+
+  n = sample_pack(pending, pending_n, data);
+  printf("val: %u (%u samples)\n", pending[0], n);
+  pending_n -= n;
+  memmove(pending, pending + n, pending_n * sizeof(pending[0]));
+
+  ant_send_broadcast_data(ctx, 1, data);
+}
+
+void record_sample(void) {
+  static uint8_t generation, skip;
+
+  if (adc_sampler_generation() == generation)
+    return;
+  generation = adc_sampler_generation();
+  if (++skip < SAMPLE_EVERY)
+    return;
+  skip = 0;
+
+  // Keep the newest readings if the radio falls behind
+  if (pending_n == SAMPLE_PACK_MAX) {
+    pending_n--;
+    memmove(pending, pending + 1, pending_n * sizeof(pending[0]));
+  }
+  pending[pending_n++] = adc_sampler_read(0);
 }
 
 int main(void) {
-  ant_configuration ant_config;
-  uint8_t adc_val;
+  ant_configuration ant_config = { 0 };
 
   ioinit();
+#if ANT_TRACE
+  ant_trace_init();
+#endif
     
   printf("\r\nBooting...\n");
 
-  // Initialize ADC
-  ADCSRA = (1 << ADPS2);      // Set ADC prescalar to 128 - 125KHz sample rate @ 16MHz 
-  ADCSRB = 0;
-
-  ADMUX = 0;                  // channel 0 and 1
-  ADMUX |= (1 << ADLAR);      // Left adjust ADC result to allow easy 8 bit reading 
-  ADMUX |= (1 << REFS0);      // Set ADC reference to AVCC
-
-  ADCSRA |= (1 << ADEN);      // Enable ADC 
+  // Sample ADC0 and ADC1 in the background (12 bit results)
+  adc_sampler_init();
 
   // Radio settings
+  ant_config.usart     = 0;
   ant_config.address   = 1;
   ant_config.master    = FALSE;
   ant_config.frequency = 0x41;
   ant_config.period    = 2370;
 
+  // Pair with device 1 (type 3, transmission type 3) only
+  ant_config.channel_id.device_number     = 1;
+  ant_config.channel_id.device_type       = 3;
+  ant_config.channel_id.transmission_type = 3;
+  ant_config.id_list_size = 0;
+
   // Set callbacks
   ant_config.callback_broadcast_recv = &callback_broadcast_recv;
 
   // Initialize and configure ANT radio
-  ant_init(ant_config);
+  ant_init(&radio, ant_config);
   
   // Main loop
   while(1) {
-    ant_handle_msg();
+    record_sample();
+    ant_handle_msg(&radio);
+#if ANT_DEFERRED_QUEUE_SIZE > 0
+    // One callback per pass, so the radio is serviced in between
+    ant_run_deferred(&radio, 1);
+#endif
   }
 }
 
@@ -121,7 +147,9 @@ void ioinit (void) {
   UCSR0B = (1<<RXEN0)|(1<<TXEN0)|(1 << RXCIE0);
 
   softuart_init();
+#if SOFTUART_RX_ENABLED
   softuart_turn_rx_off();
+#endif
   sei();
   
   stdout = &suart_stream; //Required for printf init
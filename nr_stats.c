@@ -0,0 +1,112 @@
+#include <string.h>
+
+#include "ant.h"
+#include "nr_stats.h"
+
+#if NR_STATS_WINDOW & (NR_STATS_WINDOW - 1) || NR_STATS_WINDOW > 128
+  #error "NR_STATS_WINDOW must be a power of two up to 128"
+#endif
+#if NR_STATS_EWMA_SHIFT > 15
+  #error "NR_STATS_EWMA_SHIFT must be 15 or less"
+#endif
+
+typedef struct nr_stat_window
+{
+  uint16_t samples[NR_STATS_WINDOW];
+  uint8_t next;            // Slot the next sample goes to
+  uint8_t n;               // Slots in use
+  uint32_t ewma;           // Scaled by 2^NR_STATS_EWMA_SHIFT
+  nr_stat_summary summary;
+} nr_stat_window;
+
+static nr_stat_window windows[NR_STAT_COUNT];
+
+uint8_t nr_stats_decode(const uint8_t *buf, uint8_t len, nr_stat *stat)
+{
+  if (len < 10 || buf[6] != NR_STATS_MSG || buf[7] >= NR_STAT_COUNT)
+    return FALSE;
+
+  stat->id = buf[7];
+  stat->value = buf[8] | (buf[9] << 8);
+  return TRUE;
+}
+
+void nr_stats_add(const nr_stat *stat)
+{
+  nr_stat_window *w = &windows[stat->id];
+  nr_stat_summary *s = &w->summary;
+  uint16_t v = stat->value;
+  uint16_t old = w->samples[w->next];
+  uint8_t full = (w->n == NR_STATS_WINDOW);
+  uint8_t i;
+
+  w->samples[w->next] = v;
+  w->next = (w->next + 1) & (NR_STATS_WINDOW - 1);
+
+  if (w->n == 0)
+  {
+    w->ewma = (uint32_t)v << NR_STATS_EWMA_SHIFT;
+    s->min = v;
+    s->max = v;
+  }
+  else
+  {
+    // ewma += (v - ewma) / 2^shift, kept scaled to avoid losing the
+    // fraction on every step
+    w->ewma = w->ewma - (w->ewma >> NR_STATS_EWMA_SHIFT) + v;
+
+    if (full && (old == s->min || old == s->max))
+    {
+      // The evicted sample may have been the extreme: rescan the window
+      s->min = v;
+      s->max = v;
+      for (i = 0; i < NR_STATS_WINDOW; i++)
+      {
+        if (w->samples[i] < s->min)
+          s->min = w->samples[i];
+        if (w->samples[i] > s->max)
+          s->max = w->samples[i];
+      }
+    }
+    else
+    {
+      if (v < s->min)
+        s->min = v;
+      if (v > s->max)
+        s->max = v;
+    }
+  }
+
+  if (!full)
+    w->n++;
+
+  s->last = v;
+  s->ewma = w->ewma >> NR_STATS_EWMA_SHIFT;
+  if (s->count < 0xFFFF)
+    s->count++;
+}
+
+uint8_t nr_stats_update(const uint8_t *buf, uint8_t len)
+{
+  nr_stat stat;
+
+  if (!nr_stats_decode(buf, len, &stat))
+    return FALSE;
+
+  nr_stats_add(&stat);
+  return TRUE;
+}
+
+uint8_t nr_stats_summary(uint8_t id, nr_stat_summary *summary)
+{
+  if (id >= NR_STAT_COUNT || windows[id].summary.count == 0)
+    return FALSE;
+
+  *summary = windows[id].summary;
+  return TRUE;
+}
+
+void nr_stats_reset(void)
+{
+  memset(windows, 0, sizeof(windows));
+}
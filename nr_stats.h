@@ -0,0 +1,73 @@
+/*
+  NR stats decoder --
+  Parses NR stats broadcasts into typed records and keeps a fixed-size
+  rolling window per stat, so consumers read last/min/max/EWMA summaries in
+  O(1) instead of re-parsing frames.
+
+  Message layout, as passed to callback_broadcast_recv():
+    buf[6]     NR_STATS_MSG
+    buf[7]     stat id, NR_STAT_*
+    buf[8..9]  value (little endian)
+*/
+
+#ifndef NR_STATS_H
+#define NR_STATS_H
+
+#include <stdint.h>
+
+#define NR_STATS_MSG 0x2a
+
+// Stat ids
+#define NR_STAT_APDEX          0
+#define NR_STAT_ERROR_RATE     1
+#define NR_STAT_THROUGHPUT     2
+#define NR_STAT_RESPONSE_TIME  3
+#define NR_STAT_DB             4
+#define NR_STAT_CPU            5
+#define NR_STAT_MEMORY         6
+#define NR_STAT_COUNT          7
+
+// Samples min and max are taken over (power of two). Costs two bytes of
+// RAM per sample per stat.
+#if !defined(NR_STATS_WINDOW)
+  #define NR_STATS_WINDOW 8
+#endif
+
+// EWMA weight of a new sample is 1/2^n
+#if !defined(NR_STATS_EWMA_SHIFT)
+  #define NR_STATS_EWMA_SHIFT 3
+#endif
+
+typedef struct nr_stat
+{
+  uint8_t id;       // NR_STAT_*
+  uint16_t value;
+} nr_stat;
+
+typedef struct nr_stat_summary
+{
+  uint16_t last;
+  uint16_t min;     // Over the last NR_STATS_WINDOW samples
+  uint16_t max;
+  uint16_t ewma;
+  uint16_t count;   // Samples seen, saturates at 0xFFFF
+} nr_stat_summary;
+
+// Decodes buf into stat. Returns FALSE if buf is not an NR stats message
+// or the stat id is unknown.
+uint8_t nr_stats_decode(const uint8_t *buf, uint8_t len, nr_stat *stat);
+
+// Adds a decoded sample to its stat's window
+void nr_stats_add(const nr_stat *stat);
+
+// nr_stats_decode() followed by nr_stats_add(). Returns FALSE if buf was
+// not an NR stats message.
+uint8_t nr_stats_update(const uint8_t *buf, uint8_t len);
+
+// Summary of a stat. Returns FALSE if it has no samples yet.
+uint8_t nr_stats_summary(uint8_t id, nr_stat_summary *summary);
+
+// Forgets every sample
+void nr_stats_reset(void);
+
+#endif
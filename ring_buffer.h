@@ -1,13 +1,18 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
 #include <stdio.h>
+#include <stdint.h>
 
+// Single producer / single consumer byte ring. The producer (an ISR) only
+// moves head and the consumer only moves tail, so neither side needs to
+// disable interrupts. One slot is always left empty to tell full from empty.
 typedef struct ring_buffer
 {
-  void *buffer;      // data buffer
-  void *buffer_end;  // end of data buffer
-  uint8_t capacity;  // maximum number of items in the buffer
-  uint8_t count;     // number of items in the buffer
-  void *head;        // pointer to head
-  void *tail;        // pointer to tail
+  uint8_t *buffer;   // data buffer
+  uint8_t capacity;  // size of the data buffer
+  uint8_t head;      // write index, only moved by rb_push()
+  uint8_t tail;      // read index, only moved by rb_pop()
 } ring_buffer;
 
 typedef struct pop_val
@@ -17,5 +22,56 @@ typedef struct pop_val
 } pop_value;
 
 void rb_init(volatile ring_buffer *rb, uint8_t size, void *buffer);
-void rb_push(volatile ring_buffer *rb, const uint8_t byte);
-pop_value rb_pop(volatile ring_buffer *rb);
\ No newline at end of file
+
+// push/pop sit on the RX hot path (push runs inside the USART ISR), so they
+// are inlined: a real call from an ISR makes avr-gcc save every
+// call-clobbered register in the prologue.
+// Returns 0 if the ring was full and the byte was dropped
+static inline uint8_t rb_push(volatile ring_buffer *rb, const uint8_t byte)
+{
+  uint8_t head = rb->head;
+  uint8_t next = head + 1;
+
+  if (next == rb->capacity)
+    next = 0;
+
+  // Full: drop the new byte rather than overwrite unread data
+  if (next == rb->tail)
+    return 0;
+
+  rb->buffer[head] = byte;
+  rb->head = next;
+
+  return 1;
+}
+
+static inline pop_value rb_pop(volatile ring_buffer *rb)
+{
+  pop_value value;
+  uint8_t tail = rb->tail;
+
+  if (tail == rb->head) {
+    value.success = 0;
+    return value;
+  }
+
+  value.byte = rb->buffer[tail];
+  value.success = 1;
+
+  if (++tail == rb->capacity)
+    tail = 0;
+  rb->tail = tail;
+
+  return value;
+}
+
+// Number of bytes waiting to be popped
+static inline uint8_t rb_count(volatile ring_buffer *rb)
+{
+  uint8_t head = rb->head;
+  uint8_t tail = rb->tail;
+
+  return (head >= tail) ? head - tail : rb->capacity - tail + head;
+}
+
+#endif
@@ -0,0 +1,124 @@
+#include <string.h>
+
+#include "sample_pack.h"
+
+#define SAMPLE_MASK ((1 << SAMPLE_PACK_BITS) - 1)
+
+// Per format: samples it holds and bits per value after the first
+static const uint8_t capacity[] = { 3, 5, 8 };
+static const uint8_t width[]    = { SAMPLE_PACK_BITS, 6, 4 };
+
+// Bit streams start after the header byte
+static void put_bits(uint8_t *p, uint8_t pos, uint16_t v, uint8_t n)
+{
+  uint8_t off, take;
+
+  while (n > 0)
+  {
+    off = pos & 7;
+    take = 8 - off;
+    if (take > n)
+      take = n;
+
+    p[pos >> 3] |= (v & ((1 << take) - 1)) << off;
+    v >>= take;
+    pos += take;
+    n -= take;
+  }
+}
+
+static uint16_t get_bits(const uint8_t *p, uint8_t pos, uint8_t n)
+{
+  uint16_t v = 0;
+  uint8_t off, take, got = 0;
+
+  while (got < n)
+  {
+    off = pos & 7;
+    take = 8 - off;
+    if (take > n - got)
+      take = n - got;
+
+    v |= (uint16_t)((p[pos >> 3] >> off) & ((1 << take) - 1)) << got;
+    pos += take;
+    got += take;
+  }
+
+  return v;
+}
+
+uint8_t sample_pack(const uint16_t *samples, uint8_t n, uint8_t *out)
+{
+  uint8_t format = SAMPLE_PACK_RAW;
+  uint8_t count, f, k, i, w;
+  int16_t d, limit;
+
+  if (n == 0)
+    return 0;
+
+  // Raw always works; a delta format wins if its run is longer
+  count = (n < capacity[SAMPLE_PACK_RAW]) ? n : capacity[SAMPLE_PACK_RAW];
+  for (f = SAMPLE_PACK_DELTA6; f <= SAMPLE_PACK_DELTA4; f++)
+  {
+    limit = 1 << (width[f] - 1);
+    for (k = 1; k < n && k < capacity[f]; k++)
+    {
+      d = (samples[k] & SAMPLE_MASK) - (samples[k - 1] & SAMPLE_MASK);
+      if (d < -limit || d >= limit)
+        break;
+    }
+    if (k > count)
+    {
+      format = f;
+      count = k;
+    }
+  }
+
+  memset(out, 0, SAMPLE_PACK_SIZE);
+  out[0] = SAMPLE_PACK_MSG | (format << 3) | (count - 1);
+
+  put_bits(out + 1, 0, samples[0] & SAMPLE_MASK, SAMPLE_PACK_BITS);
+  w = width[format];
+  for (i = 1; i < count; i++)
+  {
+    if (format == SAMPLE_PACK_RAW)
+      d = samples[i] & SAMPLE_MASK;
+    else
+      d = (samples[i] & SAMPLE_MASK) - (samples[i - 1] & SAMPLE_MASK);
+    put_bits(out + 1, SAMPLE_PACK_BITS + (i - 1) * w, d, w);
+  }
+
+  return count;
+}
+
+uint8_t sample_unpack(const uint8_t *in, uint16_t *samples)
+{
+  uint8_t format = (in[0] >> 3) & 3;
+  uint8_t count = (in[0] & 7) + 1;
+  uint8_t i, w;
+  uint16_t v;
+
+  if ((in[0] & SAMPLE_PACK_MASK) != SAMPLE_PACK_MSG ||
+      format > SAMPLE_PACK_DELTA4 || count > capacity[format])
+    return 0;
+
+  samples[0] = get_bits(in + 1, 0, SAMPLE_PACK_BITS);
+  w = width[format];
+  for (i = 1; i < count; i++)
+  {
+    v = get_bits(in + 1, SAMPLE_PACK_BITS + (i - 1) * w, w);
+    if (format == SAMPLE_PACK_RAW)
+    {
+      samples[i] = v;
+    }
+    else
+    {
+      // Sign extend the delta; wrapping is undone by the mask
+      if (v & (1 << (w - 1)))
+        v -= 1 << w;
+      samples[i] = (samples[i - 1] + v) & SAMPLE_MASK;
+    }
+  }
+
+  return count;
+}
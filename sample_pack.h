@@ -0,0 +1,46 @@
+/*
+  Dense sample packing --
+  Fits runs of 12 bit samples into the 6 data bytes of a broadcast. One
+  header byte names the format and the number of samples; the remaining
+  40 bits hold either raw samples or a first sample followed by signed
+  deltas:
+
+    SAMPLE_PACK_RAW     3 samples of 12 bits
+    SAMPLE_PACK_DELTA6  1 sample + 4 deltas of 6 bits (-32..31)
+    SAMPLE_PACK_DELTA4  1 sample + 7 deltas of 4 bits (-8..7)
+
+  sample_pack() picks whichever format takes the most samples, so slowly
+  changing inputs travel up to 8 per message and noisy ones no fewer than
+  3. Bits are stored least significant first.
+
+  The header's top bits are SAMPLE_PACK_MSG, which no other message of the
+  example uses in its first data byte (NR stats use 0x2a).
+*/
+
+#ifndef SAMPLE_PACK_H
+#define SAMPLE_PACK_H
+
+#include <stdint.h>
+
+#define SAMPLE_PACK_MSG    0xA0  // Header bits 7..5
+#define SAMPLE_PACK_MASK   0xE0
+
+// Header bits 4..3
+#define SAMPLE_PACK_RAW     0
+#define SAMPLE_PACK_DELTA6  1
+#define SAMPLE_PACK_DELTA4  2
+
+#define SAMPLE_PACK_BITS   12    // Sample width, larger values are masked
+#define SAMPLE_PACK_SIZE   6     // Bytes written by sample_pack()
+#define SAMPLE_PACK_MAX    8     // Most samples in one message
+
+// Packs as many of the n samples as fit, oldest first, into
+// SAMPLE_PACK_SIZE bytes at out. Returns the number packed, which is at
+// least 1 when n > 0.
+uint8_t sample_pack(const uint16_t *samples, uint8_t n, uint8_t *out);
+
+// Unpacks SAMPLE_PACK_SIZE bytes into up to SAMPLE_PACK_MAX samples.
+// Returns how many there were, or 0 if in is not a packed message.
+uint8_t sample_unpack(const uint8_t *in, uint16_t *samples);
+
+#endif
@@ -143,10 +143,12 @@ V0.4 (10/2010)
 #include <avr/pgmspace.h>
 
 #include "softuart.h"
+#include "ant_trace.h"
 
 #define SU_TRUE    1
 #define SU_FALSE   0
 
+#if SOFTUART_RX_ENABLED
 // startbit and stopbit parsed internally (see ISR)
 #define RX_NUM_OF_BITS (8)
 volatile static char           inbuf[SOFTUART_IN_BUF_SIZE];
@@ -154,6 +156,7 @@ volatile static unsigned char  qin;
 static unsigned char           qout;
 volatile static unsigned char  flag_rx_off;
 volatile static unsigned char  flag_rx_ready;
+#endif
 
 // 1 Startbit, 8 Databits, 1 Stopbit = 10 Bits/Frame
 #define TX_NUM_OF_BITS (10)
@@ -168,6 +171,7 @@ volatile static unsigned short internal_tx_buffer; /* ! mt: was type uchar - thi
 
 ISR(SOFTUART_T_COMP_LABEL)
 {
+#if SOFTUART_RX_ENABLED
 	static unsigned char flag_rx_waiting_for_stop_bit = SU_FALSE;
 	static unsigned char rx_mask;
 	
@@ -176,8 +180,11 @@ ISR(SOFTUART_T_COMP_LABEL)
 	static unsigned char internal_rx_buffer;
 	
 	unsigned char start_bit, flag_in;
+#endif
 	unsigned char tmp;
 	
+	ANT_TRACE_ISR_ENTER();
+
 	// Transmitter Section
 	if ( flag_tx_busy == SU_TRUE ) {
 		tmp = timer_tx_ctr;
@@ -196,8 +203,8 @@ ISR(SOFTUART_T_COMP_LABEL)
 		}
 		timer_tx_ctr = tmp;
 	}
-	return;
 
+#if SOFTUART_RX_ENABLED
 	// Receiver Section
 	if ( flag_rx_off == SU_FALSE ) {
 		if ( flag_rx_waiting_for_stop_bit ) {
@@ -241,6 +248,8 @@ ISR(SOFTUART_T_COMP_LABEL)
 			}
 		}
 	}
+#endif
+	ANT_TRACE_ISR_EXIT(ANT_TRACE_SOFTUART_ISR);
 }
 
 static void io_init(void)
@@ -273,8 +282,10 @@ static void timer_init(void)
 void softuart_init( void )
 {
 	flag_tx_busy  = SU_FALSE;
+#if SOFTUART_RX_ENABLED
 	flag_rx_ready = SU_FALSE;
 	flag_rx_off   = SU_FALSE;
+#endif
 	
 	set_tx_pin_high(); /* mt: set to high to avoid garbage on init */
 
@@ -282,6 +293,7 @@ void softuart_init( void )
 	timer_init();
 }
 
+#if SOFTUART_RX_ENABLED
 static void idle(void)
 {
 	// timeout handling goes here 
@@ -324,6 +336,7 @@ void softuart_flush_input_buffer( void )
 	qin  = 0;
 	qout = 0;
 }
+#endif
 	
 unsigned char softuart_transmit_busy( void ) 
 {
@@ -1,5 +1,7 @@
 #define F_CPU 8000000 // 8MHz
 
+#include "ant_config.h"
+
 #if !defined(F_CPU)
     #warning "F_CPU not defined in makefile - now defined in softuart.h"
     #define F_CPU 3686400UL
@@ -90,11 +92,12 @@
     #warning "Check SOFTUART_TIMERTOP: increase prescaler, lower F_CPU or use a 16 bit timer"
 #endif
 
-#define SOFTUART_IN_BUF_SIZE     32
+// SOFTUART_RX_ENABLED and SOFTUART_IN_BUF_SIZE are set in ant_config.h
 
 // Init the Software Uart
 void softuart_init(void);
 
+#if SOFTUART_RX_ENABLED
 // Clears the contents of the input buffer.
 void softuart_flush_input_buffer( void );
 
@@ -103,6 +106,7 @@ unsigned char softuart_kbhit( void );
 
 // Reads a character from the input buffer, waiting if necessary.
 char softuart_getchar( void );
+#endif
 
 // To check if transmitter is busy
 unsigned char softuart_transmit_busy( void );
@@ -110,11 +114,13 @@ unsigned char softuart_transmit_busy( void );
 // Writes a character to the serial port.
 void softuart_putchar( const char );
 
+#if SOFTUART_RX_ENABLED
 // Turns on the receive function.
 void softuart_turn_rx_on( void );
 
 // Turns off the receive function.
 void softuart_turn_rx_off( void );
+#endif
 
 // Write a NULL-terminated string from RAM to the serial port
 void softuart_puts( const char *s );
@@ -0,0 +1,407 @@
+#!/usr/bin/env python3
+"""Static resource report for an avr-gcc build (used by "make report").
+
+For every interrupt handler it walks the disassembly and computes an upper
+bound on the cycles from the interrupt firing to reti, following calls and
+tail calls (jumps to a function entry). Loops inside an ISR cannot be
+bounded this way and are reported as such.
+
+Stack depth comes from the -fstack-usage (.su) files plus the return
+addresses along the deepest call chain, for main() and for the worst ISR
+on top of it (ISRs don't nest). RAM and flash are broken down per object.
+
+Indirect calls (function pointers) can't be followed. --icall names what
+the ones in a function may reach; an empty list says they are never made.
+A budgeted chain with an indirect call left unresolved, or with
+recursion, fails since its bound would be too low.
+
+Exits with status 1 when a budget is exceeded or can't be checked.
+"""
+
+import argparse
+import glob
+import re
+import subprocess
+import sys
+
+# Cycles on the classic AVR core (ATmega). Conditional branches and skips
+# are charged their worst case.
+CYCLES = {
+    'adiw': 2, 'sbiw': 2, 'mul': 2, 'muls': 2, 'mulsu': 2, 'fmul': 2,
+    'fmuls': 2, 'fmulsu': 2,
+    'ld': 2, 'ldd': 2, 'st': 2, 'std': 2, 'lds': 2, 'sts': 2,
+    'push': 2, 'pop': 2, 'cbi': 2, 'sbi': 2,
+    'lpm': 3, 'elpm': 3, 'spm': 4,
+    'rjmp': 2, 'ijmp': 2, 'eijmp': 2, 'jmp': 3,
+    'rcall': 3, 'icall': 3, 'eicall': 4, 'call': 4,
+    'ret': 4, 'reti': 4,
+    'cpse': 3, 'sbrc': 3, 'sbrs': 3, 'sbic': 3, 'sbis': 3,
+}
+BRANCH_CYCLES = 2   # brXX taken
+IRQ_ENTRY_CYCLES = 4 + 3  # interrupt response + jmp in the vector table
+
+SKIPS = ('cpse', 'sbrc', 'sbrs', 'sbic', 'sbis')
+CALLS = ('call', 'rcall')
+INDIRECT = ('icall', 'eicall', 'ijmp', 'eijmp')
+RETURNS = ('ret', 'reti')
+
+LABEL_RE = re.compile(r'^([0-9a-f]+) <([^>]+)>:$')
+INSN_RE = re.compile(r'^\s*([0-9a-f]+):\t([0-9a-f ]+?)\s*\t(\S+)\s*(.*)$')
+
+
+class Insn(object):
+    def __init__(self, addr, size, op, args):
+        self.addr = addr
+        self.size = size
+        self.op = op
+        self.args = args
+
+    def target(self):
+        """Absolute byte address of a jump, call or branch."""
+        m = re.search(r';\s*0x([0-9a-f]+)', self.args)
+        if not m:
+            m = re.match(r'(?:0x)?([0-9a-f]+)', self.args)
+        return int(m.group(1), 16) if m else None
+
+
+def run(cmd):
+    return subprocess.check_output(cmd, universal_newlines=True)
+
+
+def disassemble(objdump, elf):
+    """Returns ({addr: Insn}, {name: addr}, {addr: name})."""
+    insns, funcs = {}, {}
+    for line in run([objdump, '-d', elf]).splitlines():
+        m = LABEL_RE.match(line)
+        if m:
+            funcs[m.group(2)] = int(m.group(1), 16)
+            continue
+        m = INSN_RE.match(line)
+        if m:
+            addr = int(m.group(1), 16)
+            size = len(m.group(2).split())
+            insns[addr] = Insn(addr, size, m.group(3), m.group(4))
+    return insns, funcs, dict((a, n) for n, a in funcs.items())
+
+
+class Analysis(object):
+    def __init__(self, insns, funcs, names, stack, icalls):
+        self.insns = insns
+        self.funcs = funcs
+        self.names = names
+        self.stack = stack
+        self.icalls = icalls    # {function name: [target addresses]}
+        self.cycle_memo = {}
+        self.func_memo = {}
+        self.notes = {}
+
+    def note(self, func, text):
+        self.notes.setdefault(func, set()).add(text)
+
+    def func_cycles(self, entry, active=()):
+        """Upper bound on cycles spent in the function at entry."""
+        if entry in self.func_memo:
+            return self.func_memo[entry]
+        name = self.names.get(entry, hex(entry))
+        if entry in active:
+            self.note(name, 'recursive')
+            return 0
+        self.cycle_memo[entry] = {}
+        cost = self.path_cycles(entry, entry, active + (entry,))
+        self.func_memo[entry] = cost
+        return cost
+
+    def path_cycles(self, addr, entry, active):
+        memo = self.cycle_memo[entry]
+        name = self.names.get(entry, hex(entry))
+        if addr in memo:
+            return memo[addr]
+        insn = self.insns.get(addr)
+        if insn is None:
+            return 0
+        memo[addr] = 0  # guards against revisiting while in progress
+
+        op = insn.op
+        here = CYCLES.get(op, BRANCH_CYCLES if op.startswith('br') else 1)
+        nxt = addr + insn.size
+        succ = []
+
+        if op in RETURNS:
+            pass
+        elif op in INDIRECT and 'call' in op:
+            if name in self.icalls:
+                here += max([self.call_cycles(t, name, active)
+                             for t in self.icalls[name]] or [0])
+            else:
+                self.note(name, 'indirect call')
+            succ.append(nxt)
+        elif op in INDIRECT:
+            self.note(name, 'indirect jump')
+        elif op in CALLS:
+            target = insn.target()
+            if target is not None:
+                here += self.call_cycles(target, name, active)
+            succ.append(nxt)
+        elif op in ('rjmp', 'jmp') and self.is_tail_call(insn, entry):
+            # Returns straight to our caller
+            here += self.call_cycles(insn.target(), name, active)
+        elif op in ('rjmp', 'jmp'):
+            succ.append(insn.target())
+        elif op.startswith('br'):
+            succ += [nxt, insn.target()]
+        elif op in SKIPS:
+            after = self.insns.get(nxt)
+            succ += [nxt, nxt + (after.size if after else 2)]
+        else:
+            succ.append(nxt)
+
+        worst = 0
+        for s in succ:
+            if s is None:
+                continue
+            if s <= addr:
+                self.note(name, 'loop')
+                continue
+            worst = max(worst, self.path_cycles(s, entry, active))
+
+        memo[addr] = here + worst
+        return memo[addr]
+
+    def call_cycles(self, target, caller, active):
+        cost = self.func_cycles(target, active)
+        callee = self.names.get(target, hex(target))
+        if self.notes.get(callee, set()) & set(['loop', 'indirect call']):
+            self.note(caller, 'loop or indirect call in ' + callee)
+        return cost
+
+    def is_tail_call(self, insn, entry):
+        """A jump to the start of another function."""
+        target = insn.target()
+        return target in self.names and target != entry
+
+    def callees(self, entry):
+        """Functions the one at entry calls, as {address: tail call}."""
+        out = {}
+        name = self.names.get(entry, hex(entry))
+        end = min([a for a in self.names if a > entry] or [max(self.insns) + 1])
+        for addr in sorted(a for a in self.insns if entry <= a < end):
+            insn = self.insns[addr]
+            if insn.op in CALLS:
+                t = insn.target()
+                if t is not None:
+                    out[t] = False
+            elif insn.op in ('rjmp', 'jmp') and self.is_tail_call(insn, entry):
+                out.setdefault(insn.target(), True)
+            elif insn.op in INDIRECT and 'call' in insn.op:
+                if name in self.icalls:
+                    for t in self.icalls[name]:
+                        out[t] = False
+                else:
+                    self.note(name, 'indirect call')
+        return out
+
+    def stack_depth(self, entry, ret_bytes, active=()):
+        """Deepest stack use in bytes starting at the function at entry."""
+        name = self.names.get(entry, hex(entry))
+        if entry in active:
+            self.note(name, 'recursive')
+            return 0, [name]
+        own = self.stack.get(name)
+        if own is None:
+            own = self.estimate_frame(entry)
+            self.note(name, 'no .su, estimated from pushes')
+        best, chain = 0, []
+        for callee, tail in self.callees(entry).items():
+            depth, sub = self.stack_depth(callee, ret_bytes, active + (entry,))
+            # A tail call reuses our return address
+            if not tail:
+                depth += ret_bytes
+            if depth > best:
+                best, chain = depth, sub
+        return own + best, [name] + chain
+
+    def chain_problems(self, entry, loops=False):
+        """What makes the bounds for the call tree at entry unreliable:
+        recursion, unresolved indirect calls and, for cycles, loops."""
+        problems, done = [], set()
+
+        def walk(addr, path):
+            if addr in path:
+                cycle = path[path.index(addr):] + (addr,)
+                problems.append('recursion ' + ' > '.join(
+                    self.names.get(a, hex(a)) for a in cycle))
+                return
+            if addr in done:
+                return
+            name = self.names.get(addr, hex(addr))
+            for callee in sorted(self.callees(addr)):
+                walk(callee, path + (addr,))
+            done.add(addr)
+            notes = self.notes.get(name, set())
+            if 'indirect call' in notes:
+                problems.append('unresolved indirect call in ' + name)
+            if loops and 'loop' in notes:
+                problems.append('loop in ' + name)
+
+        walk(entry, ())
+        return problems
+
+    def estimate_frame(self, entry):
+        end = min([a for a in self.names if a > entry] or [max(self.insns) + 1])
+        return 2 * sum(1 for a, i in self.insns.items()
+                       if entry <= a < end and i.op == 'push')
+
+
+def read_stack_usage(paths):
+    usage = {}
+    for path in paths:
+        for line in open(path):
+            parts = line.rstrip('\n').split('\t')
+            if len(parts) >= 2:
+                name = parts[0].rsplit(':', 1)[-1]
+                usage[name] = max(usage.get(name, 0), int(parts[1]))
+    return usage
+
+
+def vector_numbers(cc, mcu):
+    """Maps ISR names (USART_RX_vect) to their __vector_N symbols."""
+    out = run([cc, '-mmcu=' + mcu, '-E', '-dM', '-include', 'avr/io.h',
+               '-x', 'c', '/dev/null'])
+    vectors = {}
+    for m in re.finditer(r'#define (\w+_vect) _VECTOR\((\d+)\)', out):
+        vectors[m.group(1)] = '__vector_' + m.group(2)
+    return vectors
+
+
+def module_sizes(size_tool, objects):
+    rows = []
+    out = run([size_tool] + objects).splitlines()[1:]
+    for line in out:
+        text, data, bss = [int(x) for x in line.split()[:3]]
+        rows.append((line.split()[-1], text + data, data + bss))
+    return rows
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument('--elf', required=True)
+    ap.add_argument('--mcu', required=True)
+    ap.add_argument('--cc', default='avr-gcc')
+    ap.add_argument('--objdump', default='avr-objdump')
+    ap.add_argument('--size', default='avr-size')
+    ap.add_argument('--isr', action='append', default=[],
+                    metavar='NAME=CYCLES', help='ISR cycle budget')
+    ap.add_argument('--icall', action='append', default=[],
+                    metavar='FUNC=TARGET,...',
+                    help='what indirect calls in FUNC may reach')
+    ap.add_argument('--stack-budget', type=int, default=0)
+    ap.add_argument('--ram-budget', type=int, default=0)
+    ap.add_argument('--flash-budget', type=int, default=0)
+    ap.add_argument('--ret-bytes', type=int, default=2,
+                    help='return address size (3 on >128K parts)')
+    ap.add_argument('objects', nargs='*')
+    args = ap.parse_args()
+
+    insns, funcs, names = disassemble(args.objdump, args.elf)
+    stack = read_stack_usage(glob.glob('*.su'))
+    vectors = vector_numbers(args.cc, args.mcu)
+    failed = []
+
+    icalls = {}
+    for spec in args.icall:
+        name, _, targets = spec.partition('=')
+        icalls[name] = []
+        for t in filter(None, targets.split(',')):
+            if t in funcs:
+                icalls[name].append(funcs[t])
+            else:
+                failed.append('--icall %s: no function %s' % (name, t))
+    an = Analysis(insns, funcs, names, stack, icalls)
+
+    budgets = {}
+    for spec in args.isr:
+        name, _, cycles = spec.partition('=')
+        budgets[name] = int(cycles)
+
+    # ISRs: every __vector_N defined in the ELF, named where we know it
+    by_symbol = dict((v, k) for k, v in vectors.items())
+    isrs = sorted((n for n in funcs if re.match(r'__vector_\d+$', n)),
+                  key=lambda n: int(n.split('_')[-1]))
+    for name in budgets:
+        if vectors.get(name) not in funcs:
+            failed.append('%s: no such ISR in %s' % (name, args.elf))
+
+    print('Interrupt handlers (worst case, incl. %d cycles entry)'
+          % IRQ_ENTRY_CYCLES)
+    print('  %-22s %-12s %7s %7s  %s' % ('vector', 'symbol', 'cycles',
+                                        'budget', 'notes'))
+    isr_stack = (0, [])
+    stack_problems = []
+    for sym in isrs:
+        label = by_symbol.get(sym, '?')
+        cycles = IRQ_ENTRY_CYCLES + an.func_cycles(funcs[sym])
+        depth, chain = an.stack_depth(funcs[sym], args.ret_bytes)
+        # the interrupt itself pushes the return address
+        depth += args.ret_bytes
+        if depth > isr_stack[0]:
+            isr_stack = (depth, chain)
+        stack_problems += an.chain_problems(funcs[sym])
+        budget = budgets.get(label)
+        notes = sorted(an.notes.get(sym, ()))
+        if 'loop' in notes:
+            notes[notes.index('loop')] = 'loop, bound not valid'
+        print('  %-22s %-12s %7d %7s  %s' % (label, sym, cycles,
+                                            budget if budget else '-',
+                                            ', '.join(notes)))
+        problems = an.chain_problems(funcs[sym], loops=True) if budget else []
+        for p in problems:
+            failed.append('%s: %s, cannot be bounded' % (label, p))
+        if budget and not problems and cycles > budget:
+            failed.append('%s: %d cycles > budget %d' % (label, cycles,
+                                                         budget))
+
+    main_depth, main_chain = an.stack_depth(funcs['main'], args.ret_bytes)
+    peak = main_depth + isr_stack[0]
+    print('')
+    print('Stack')
+    print('  main   %4d bytes  %s' % (main_depth, ' > '.join(main_chain)))
+    print('  ISR    %4d bytes  %s' % (isr_stack[0], ' > '.join(isr_stack[1])))
+    print('  peak   %4d bytes%s' % (peak, '  (budget %d)' % args.stack_budget
+                                    if args.stack_budget else ''))
+    unknown = sorted(n for n, t in an.notes.items()
+                     if 'no .su, estimated from pushes' in t)
+    if unknown:
+        print('  estimated: ' + ', '.join(unknown))
+    stack_problems += an.chain_problems(funcs['main'])
+    if args.stack_budget:
+        for p in sorted(set(stack_problems)):
+            failed.append('stack: %s, cannot be bounded' % p)
+    if args.stack_budget and peak > args.stack_budget:
+        failed.append('stack: %d bytes > budget %d' % (peak,
+                                                       args.stack_budget))
+
+    print('')
+    print('Memory per module')
+    print('  %-20s %7s %7s' % ('object', 'flash', 'ram'))
+    for obj, flash, ram in module_sizes(args.size, args.objects):
+        print('  %-20s %7d %7d' % (obj, flash, ram))
+    _, flash, ram = module_sizes(args.size, [args.elf])[0]
+    print('  %-20s %7d %7d' % ('total (' + args.elf + ')', flash, ram))
+    print('  %-20s %7s %7d' % ('ram + stack peak', '', ram + peak))
+    if args.ram_budget and ram + peak > args.ram_budget:
+        failed.append('ram: %d bytes + %d stack > budget %d' % (
+            ram, peak, args.ram_budget))
+    if args.flash_budget and flash > args.flash_budget:
+        failed.append('flash: %d bytes > budget %d' % (flash,
+                                                       args.flash_budget))
+
+    if failed:
+        print('')
+        for f in failed:
+            print('BUDGET EXCEEDED: ' + f)
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())